@@ -0,0 +1,219 @@
+#include <ctype.h>
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QFileInfo>
+#include "assets.h"
+
+void Template::compile(const QByteArray &data, int count)
+{
+    int start = 0;
+
+    m_segments.clear();
+    m_slots.clear();
+    m_length = 0;
+
+    for (int i = 0; i < data.length() - 1; i++)
+    {
+        int index = 0, length = 0;
+
+        if (data.at(i) != '%')
+            continue;
+
+        while (length < 2 && i + length + 1 < data.length() && isdigit(static_cast <uchar> (data.at(i + length + 1))))
+        {
+            index = index * 10 + data.at(i + length + 1) - '0';
+            length++;
+        }
+
+        if (index < 1 || index > count)
+            continue;
+
+        m_segments.append(data.mid(start, i - start));
+        m_slots.append(index - 1);
+        m_length += i - start;
+
+        i += length;
+        start = i + 1;
+    }
+
+    m_segments.append(data.mid(start));
+    m_length += data.length() - start;
+}
+
+QByteArray Template::render(const QList <QString> &values)
+{
+    QList <QByteArray> list;
+    QByteArray buffer;
+    int length = m_length;
+
+    for (int i = 0; i < values.count(); i++)
+        list.append(escape(values.at(i)));
+
+    for (int i = 0; i < m_slots.count(); i++)
+        length += list.value(m_slots.at(i)).length();
+
+    buffer.reserve(length);
+
+    for (int i = 0; i < m_slots.count(); i++)
+        buffer.append(m_segments.at(i)).append(list.value(m_slots.at(i)));
+
+    return buffer.append(m_segments.last());
+}
+
+QByteArray Template::escape(const QString &value)
+{
+    QByteArray data = value.toUtf8(), buffer;
+    int length = data.length();
+
+    for (int i = 0; i < data.length(); i++)
+    {
+        switch (data.at(i))
+        {
+            case '&':  length += 4; break;
+            case '<':  length += 3; break;
+            case '>':  length += 3; break;
+            case '"':  length += 5; break;
+            case '\'': length += 4; break;
+        }
+    }
+
+    if (length == data.length())
+        return data;
+
+    buffer.reserve(length);
+
+    for (int i = 0; i < data.length(); i++)
+    {
+        switch (data.at(i))
+        {
+            case '&':  buffer.append("&amp;"); break;
+            case '<':  buffer.append("&lt;"); break;
+            case '>':  buffer.append("&gt;"); break;
+            case '"':  buffer.append("&quot;"); break;
+            case '\'': buffer.append("&#39;"); break;
+            default:   buffer.append(data.at(i)); break;
+        }
+    }
+
+    return buffer;
+}
+
+AssetObject::AssetObject(const QString &fileName, const QString &type, const QString &cacheControl, int arguments) : m_valid(false)
+{
+    QFile file(fileName);
+
+    if (!file.open(QFile::ReadOnly))
+        return;
+
+    m_data = file.readAll();
+    file.close();
+
+    m_etag = QByteArray("\"").append(QCryptographicHash::hash(m_data, QCryptographicHash::Md5).toHex()).append('"');
+    m_notModified = QString("\r\nETag: %1\r\nCache-Control: %2").arg(m_etag.constData(), cacheControl).toUtf8();
+    m_headers = QString("\r\nContent-Type: %1\r\nContent-Length: %2").arg(type).arg(m_data.length()).toUtf8().append(m_notModified);
+    m_valid = true;
+
+    if (!arguments)
+        return;
+
+    m_template.compile(m_data, arguments);
+}
+
+bool AssetObject::match(const QString &value)
+{
+    QList <QString> list = value.split(',');
+
+    for (int i = 0; i < list.count(); i++)
+    {
+        QString item = list.at(i).trimmed();
+
+        if (item.startsWith("W/"))
+            item = item.mid(2);
+
+        if (item == "*" || item.toUtf8() == m_etag)
+            return true;
+    }
+
+    return false;
+}
+
+QByteArray AssetObject::render(const QList <QString> &values)
+{
+    return m_template.compiled() ? m_template.render(values) : m_data;
+}
+
+Assets::Assets(const QString &path, QObject *parent) : QObject(parent), m_watcher(new QFileSystemWatcher(this)), m_path(path), m_reloadCounter(Metrics::instance()->counter("asset_reloads_total"))
+{
+    if (!m_path.isEmpty())
+        m_watcher->addPath(m_path);
+
+    connect(m_watcher, &QFileSystemWatcher::fileChanged, this, &Assets::fileChanged);
+    connect(m_watcher, &QFileSystemWatcher::directoryChanged, this, &Assets::directoryChanged);
+}
+
+void Assets::add(const QString &name, const QString &type, const QString &cacheControl, int arguments)
+{
+    m_lock.lockForWrite();
+    m_entries.insert(name, {type, cacheControl, arguments, Asset()});
+    m_lock.unlock();
+
+    load(name);
+}
+
+Asset Assets::asset(const QString &name)
+{
+    QReadLocker lock(&m_lock);
+    return m_entries.value(name).asset;
+}
+
+void Assets::load(const QString &name)
+{
+    QString fileName = QString("%1/%2").arg(m_path, name);
+    Asset asset;
+    Entry entry;
+
+    m_lock.lockForRead();
+    entry = m_entries.value(name);
+    m_lock.unlock();
+
+    asset = Asset(new AssetObject(fileName, entry.type, entry.cacheControl, entry.arguments));
+
+    if (!asset->valid())
+    {
+        qWarning() << "Asset" << fileName << "unavailable";
+        asset.clear();
+    }
+    else if (!m_watcher->files().contains(fileName))
+        m_watcher->addPath(fileName);
+
+    m_lock.lockForWrite();
+    m_entries[name].asset = asset;
+    m_lock.unlock();
+
+    emit updated(name);
+}
+
+void Assets::fileChanged(const QString &fileName)
+{
+    QString name = QFileInfo(fileName).fileName();
+
+    if (!m_entries.contains(name))
+        return;
+
+    qDebug() << "Asset" << fileName << "changed, reloading";
+    m_reloadCounter->increment();
+    load(name);
+}
+
+void Assets::directoryChanged(void)
+{
+    for (auto it = m_entries.begin(); it != m_entries.end(); it++)
+    {
+        QString fileName = QString("%1/%2").arg(m_path, it.key());
+
+        if (m_watcher->files().contains(fileName) == QFile::exists(fileName))
+            continue;
+
+        fileChanged(fileName);
+    }
+}
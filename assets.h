@@ -0,0 +1,102 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#include <QFile>
+#include <QFileSystemWatcher>
+#include <QReadWriteLock>
+#include <QSharedPointer>
+#include "metrics.h"
+
+class Template
+{
+
+public:
+
+    Template(void) : m_length(0) {}
+
+    inline bool compiled(void) { return !m_segments.isEmpty(); }
+
+    void compile(const QByteArray &data, int count);
+    QByteArray render(const QList <QString> &values);
+
+    static QByteArray escape(const QString &value);
+
+private:
+
+    QList <QByteArray> m_segments;
+    QList <int> m_slots;
+    int m_length;
+
+};
+
+class AssetObject
+{
+
+public:
+
+    AssetObject(const QString &fileName, const QString &type, const QString &cacheControl, int arguments = 0);
+
+    inline bool valid(void) { return m_valid; }
+
+    inline QByteArray data(void) { return m_data; }
+    inline QByteArray etag(void) { return m_etag; }
+
+    inline QByteArray headers(void) { return m_headers; }
+    inline QByteArray notModified(void) { return m_notModified; }
+
+    bool match(const QString &value);
+    QByteArray render(const QList <QString> &values);
+
+private:
+
+    bool m_valid;
+
+    QByteArray m_data, m_etag, m_headers, m_notModified;
+    Template m_template;
+
+};
+
+typedef QSharedPointer <AssetObject> Asset;
+
+class Assets : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    Assets(const QString &path, QObject *parent = nullptr);
+
+    void add(const QString &name, const QString &type, const QString &cacheControl, int arguments = 0);
+    Asset asset(const QString &name);
+
+private:
+
+    struct Entry
+    {
+        QString type, cacheControl;
+        int arguments;
+        Asset asset;
+    };
+
+    QFileSystemWatcher *m_watcher;
+    QString m_path;
+
+    QMap <QString, Entry> m_entries;
+    QReadWriteLock m_lock;
+
+    Counter *m_reloadCounter;
+
+    void load(const QString &name);
+
+private slots:
+
+    void fileChanged(const QString &fileName);
+    void directoryChanged(void);
+
+signals:
+
+    void updated(const QString &name);
+
+};
+
+#endif
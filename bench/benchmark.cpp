@@ -0,0 +1,53 @@
+#include <algorithm>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include "benchmark.h"
+
+void Benchmark::run(const QString &name, const std::function <void (void)> &function, qint64 bytes)
+{
+    QList <double> samples;
+    QElapsedTimer timer;
+    QJsonObject result;
+    qint64 iterations = 1;
+    double median;
+
+    if (!m_filter.match(name).hasMatch())
+        return;
+
+    function();
+
+    while (true)
+    {
+        timer.start();
+
+        for (qint64 i = 0; i < iterations; i++)
+            function();
+
+        if (timer.nsecsElapsed() >= BENCHMARK_MIN_TIME / BENCHMARK_RUNS)
+            break;
+
+        iterations *= 2;
+    }
+
+    for (int i = 0; i < BENCHMARK_RUNS; i++)
+    {
+        timer.start();
+
+        for (qint64 j = 0; j < iterations; j++)
+            function();
+
+        samples.append(static_cast <double> (timer.nsecsElapsed()) / iterations);
+    }
+
+    std::sort(samples.begin(), samples.end());
+    median = samples.at(BENCHMARK_RUNS / 2);
+
+    result = {{"name", name}, {"iterations", iterations * BENCHMARK_RUNS}, {"ns_per_op", median}, {"ns_per_op_min", samples.first()}, {"ns_per_op_max", samples.last()}, {"ops_per_sec", 1e9 / median}};
+
+    if (bytes)
+        result.insert("mb_per_sec", bytes * 1e3 / median);
+
+    qInfo().noquote() << QString("%1: %2 ns/op").arg(name, -32).arg(median, 0, 'f', 1);
+    m_results.append(result);
+}
@@ -0,0 +1,34 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#define BENCHMARK_MIN_TIME      200000000
+#define BENCHMARK_RUNS          5
+#define BENCHMARK_OBJECTS       100000
+#define BENCHMARK_CONNECTIONS   1000
+#define BENCHMARK_DEVICES       20
+#define BENCHMARK_HUBS          1000
+#define BENCHMARK_STREAMS       100
+#define BENCHMARK_ROUNDS        1000
+
+#include <functional>
+#include <QJsonArray>
+#include <QRegularExpression>
+
+class Benchmark
+{
+
+public:
+
+    Benchmark(const QString &filter) : m_filter(filter) {}
+
+    void run(const QString &name, const std::function <void (void)> &function, qint64 bytes = 0);
+    QJsonArray results(void) { return m_results; }
+
+private:
+
+    QRegularExpression m_filter;
+    QJsonArray m_results;
+
+};
+
+#endif
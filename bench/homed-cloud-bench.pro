@@ -0,0 +1,42 @@
+QT = core network
+
+CONFIG += c++17 console
+
+INCLUDEPATH += ..
+
+SOURCES += \
+        ../capability.cpp \
+        ../client.cpp \
+        ../compress.cpp \
+        ../crypto.cpp \
+        ../metrics.cpp \
+        ../tls.cpp \
+        ../transport.cpp \
+        ../upgrade.cpp \
+        ../user.cpp \
+        ../watchdog.cpp \
+        ../wheel.cpp \
+        ../worker.cpp \
+        ../yandex.cpp \
+        benchmark.cpp \
+        main.cpp
+
+HEADERS += \
+    ../capability.h \
+    ../client.h \
+    ../compress.h \
+    ../crypto.h \
+    ../metrics.h \
+    ../tls.h \
+    ../transport.h \
+    ../upgrade.h \
+    ../user.h \
+    ../watchdog.h \
+    ../wheel.h \
+    ../worker.h \
+    ../yandex.h \
+    benchmark.h
+
+LIBS += -lz
+
+TARGET = homed-cloud-bench
@@ -0,0 +1,525 @@
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <QtEndian>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QRandomGenerator>
+#include <QTextStream>
+#include "benchmark.h"
+#include "compress.h"
+#include "worker.h"
+#include "yandex.h"
+
+static volatile quint64 sink;
+
+static QByteArray randomData(int length)
+{
+    QByteArray data(length, 0);
+
+    for (int i = 0; i < length; i++)
+        data[i] = static_cast <char> (QRandomGenerator::global()->bounded(256));
+
+    return data;
+}
+
+static qint64 residentMemory(void)
+{
+    QFile file("/proc/self/statm");
+
+    if (!file.open(QFile::ReadOnly))
+        return 0;
+
+    return QString(file.readAll()).split(0x20).value(1).toLongLong() * sysconf(_SC_PAGESIZE);
+}
+
+static qint64 socketMemory(void)
+{
+    QFile file("/proc/net/sockstat");
+    QList <QString> list;
+
+    if (!file.open(QFile::ReadOnly))
+        return 0;
+
+    while (!file.atEnd())
+    {
+        list = QString(file.readLine()).simplified().split(0x20);
+
+        if (list.value(0) == "TCP:" && list.indexOf("mem") > 0)
+            return list.value(list.indexOf("mem") + 1).toLongLong() * sysconf(_SC_PAGESIZE);
+    }
+
+    return 0;
+}
+
+static Endpoint createEndpoint(const Device &device, quint8 id, const QList <QString> &exposes, const QMap <QString, QVariant> &options)
+{
+    Endpoint endpoint(new EndpointObject(id, device, false));
+
+    endpoint->exposes() = exposes;
+    endpoint->options() = options;
+
+    Client::parseExposes(endpoint);
+    return endpoint;
+}
+
+static QMap <QString, QVariant> lightOptions(void)
+{
+    return {{"light", QList <QVariant> {"level", "color", "colorTemperature", "colorMode"}}, {"colorTemperature", QMap <QString, QVariant> {{"min", 153}, {"max", 500}}}};
+}
+
+static QMap <QString, QVariant> worstOptions(void)
+{
+    QMap <QString, QVariant> options = lightOptions();
+
+    options.insert("systemMode", QMap <QString, QVariant> {{"enum", QList <QVariant> {"off", "auto", "heat", "cool", "dry", "fan"}}});
+    options.insert("fanMode", QMap <QString, QVariant> {{"enum", QList <QVariant> {"auto", "low", "medium", "high"}}});
+    options.insert("heatMode", QMap <QString, QVariant> {{"enum", QList <QVariant> {"normal", "boost", "eco"}}});
+    options.insert("swingMode", QMap <QString, QVariant> {{"enum", QList <QVariant> {"off", "vertical", "horizontal"}}});
+    options.insert("action", QMap <QString, QVariant> {{"enum", QList <QVariant> {"singleClick", "doubleClick", "hold"}}});
+    options.insert("switch", "outlet");
+
+    return options;
+}
+
+static void populateClient(Client *client, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        QString key = QString("zigbee/00:12:4b:00:00:00:%1:%2").arg(i >> 8 & 0xFF, 2, 16, QChar('0')).arg(i & 0xFF, 2, 16, QChar('0'));
+        Device device(new DeviceObject(key, key, QString("Device %1").arg(i), "bench"));
+        Endpoint endpoint;
+
+        switch (i % 4)
+        {
+            case 0:  endpoint = createEndpoint(device, 0, {"temperature", "humidity", "battery"}, {}); break;
+            case 1:  endpoint = createEndpoint(device, 0, {"switch", "power", "energy"}, {{"switch", "outlet"}}); break;
+            case 2:  endpoint = createEndpoint(device, 0, {"light"}, lightOptions()); break;
+            default: endpoint = createEndpoint(device, 0, {"contact", "battery"}, {}); break;
+        }
+
+        for (auto it = endpoint->properties().begin(); it != endpoint->properties().end(); it++)
+            it.value()->setValue(QRandomGenerator::global()->bounded(100));
+
+        device->endpoints().insert(0, endpoint);
+        device->setAvailable(true);
+        client->devices().insert(key, device);
+    }
+}
+
+static Client *createClient(int count)
+{
+    Client *client = new Client(new SocketTransport(new QTcpSocket));
+    populateClient(client, count);
+    return client;
+}
+
+static void connectionMemory(QJsonObject &memory, bool native)
+{
+    TransportServer server(native);
+    QString prefix = native ? "native" : "qt";
+    QList <Client*> clients;
+    QList <int> peers;
+    sockaddr_in address;
+    rlimit limit;
+    DH dh;
+    handshakeRequest request = {qToBigEndian(dh.prime()), qToBigEndian(dh.generator()), qToBigEndian(dh.sharedKey())};
+    qint64 usage, sockets, idle;
+
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+
+    if (!server.listen(QHostAddress::LocalHost))
+        return;
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(server.serverPort());
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    usage = residentMemory();
+    sockets = socketMemory();
+
+    for (int i = 0; i < BENCHMARK_CONNECTIONS; i++)
+    {
+        int descriptor = socket(AF_INET, SOCK_STREAM, 0);
+
+        if (descriptor < 0 || ::connect(descriptor, reinterpret_cast <sockaddr*> (&address), sizeof(address)) < 0 || !server.waitForNewConnection(1000))
+        {
+            if (descriptor >= 0)
+                close(descriptor);
+
+            break;
+        }
+
+        peers.append(descriptor);
+        clients.append(new Client(server.nextTransport()));
+    }
+
+    if (clients.isEmpty())
+        return;
+
+    memory.insert(QString("client/%1/handshake").arg(prefix), (residentMemory() - usage) / clients.count());
+
+    for (int i = 0; i < peers.count(); i++)
+        sink += write(peers.at(i), &request, sizeof(request));
+
+    for (int i = 0; i < 10; i++)
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 100);
+
+    memory.insert(QString("client/%1/authorization").arg(prefix), (residentMemory() - usage) / clients.count());
+
+    for (int i = 0; i < clients.count(); i++)
+    {
+        clients.at(i)->authorize();
+        clients.at(i)->resume();
+    }
+
+    memory.insert(QString("client/%1/ready").arg(prefix), (residentMemory() - usage) / clients.count());
+
+    for (int i = 0; i < clients.count(); i++)
+        populateClient(clients.at(i), BENCHMARK_DEVICES);
+
+    memory.insert(QString("client/%1/ready/%2").arg(prefix).arg(BENCHMARK_DEVICES), (residentMemory() - usage) / clients.count());
+
+    for (int i = 0; i < 10; i++)
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 100);
+
+    for (int i = 0; i < peers.count(); i++)
+    {
+        char buffer[FRAME_BUFFER_SIZE];
+
+        while (recv(peers.at(i), buffer, sizeof(buffer), MSG_DONTWAIT) > 0);
+    }
+
+    idle = residentMemory() - usage + socketMemory() - sockets;
+    memory.insert(QString("client/%1/idle").arg(prefix), idle / clients.count());
+    qInfo().noquote() << QString("%1: %2 bytes per hub with %3 devices").arg(QString("memory/%1/idle").arg(prefix), -32).arg(idle / clients.count()).arg(BENCHMARK_DEVICES);
+
+    qDeleteAll(clients);
+
+    for (int i = 0; i < peers.count(); i++)
+        close(peers.at(i));
+}
+
+static QJsonObject connectionHandoff(void)
+{
+    QString path = QDir::temp().filePath(QString("homed-cloud-bench-%1.sock").arg(QCoreApplication::applicationPid()));
+    Worker worker(0, QByteArray(), QByteArray(), false);
+    Upgrade source(path), target(path);
+    Client *client = createClient(BENCHMARK_DEVICES);
+    QJsonObject state = client->handoff();
+    QList <int> peers;
+    QThread *thread;
+    QEventLoop loop;
+    QElapsedTimer timer;
+    qint64 elapsed = 0;
+    int verified = 0;
+
+    delete client;
+
+    for (int i = 0; i < BENCHMARK_CONNECTIONS; i++)
+    {
+        int descriptors[2];
+
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, descriptors) < 0)
+            break;
+
+        state.insert("uniqueId", QString("bench-%1").arg(i));
+        state.insert("key", QString(randomData(16).toHex()));
+        state.insert("iv", QString(randomData(16).toHex()));
+
+        client = new Client(Transport::create(descriptors[0], true));
+        client->restore(state);
+        client->moveToThread(worker.thread());
+
+        worker.post([i, client] (Worker *worker) { worker->attach(i + 1, "bench", client); });
+        peers.append(descriptors[1]);
+    }
+
+    source.listen();
+
+    QObject::connect(&source, &Upgrade::requested, [&worker, &source, &loop, &timer] ()
+    {
+        QList <Handoff> clients;
+
+        timer.start();
+        QMetaObject::invokeMethod(&worker, [&worker, &clients] () { clients = worker.handoff(); }, Qt::BlockingQueuedConnection);
+        source.send(QMap <QString, int> (), clients);
+        loop.quit();
+    });
+
+    thread = QThread::create([&target, &timer, &elapsed] () { target.receive(); elapsed = timer.nsecsElapsed(); });
+    thread->start();
+    loop.exec();
+    thread->wait();
+    delete thread;
+
+    for (int i = 0; i < target.clients().count(); i++)
+    {
+        const Handoff &handoff = target.clients().at(i);
+        int index = handoff.state.value("uniqueId").toString().mid(6).toInt();
+        char data = 0x42;
+
+        if (handoff.state.value("devices").toArray().count() == BENCHMARK_DEVICES && index < peers.count() && write(handoff.descriptor, &data, 1) == 1 && read(peers.at(index), &data, 1) == 1)
+            verified++;
+
+        close(handoff.descriptor);
+    }
+
+    for (int i = 0; i < peers.count(); i++)
+        close(peers.at(i));
+
+    if (verified != peers.count())
+        qWarning() << "Connection handoff verified for" << verified << "of" << peers.count() << "clients";
+
+    qInfo().noquote() << QString("%1: %2 ms for %3 clients").arg("handoff/upgrade", -32).arg(elapsed / 1e6, 0, 'f', 2).arg(peers.count());
+    return {{"clients", peers.count()}, {"devices", BENCHMARK_DEVICES}, {"verified", verified}, {"ms", elapsed / 1e6}};
+}
+
+static QByteArray telemetryFrame(AES128 &aes, const QString &topic, const QJsonObject &message)
+{
+    QByteArray frame = QJsonDocument(QJsonObject {{"action", "publish"}, {"topic", QString("fd/").append(topic)}, {"message", message}}).toJson(QJsonDocument::Compact);
+
+    if (frame.length() % 16)
+        frame.append(16 - frame.length() % 16, 0);
+
+    aes.cbcEncrypt(frame);
+    return Client::encodeFrame(frame);
+}
+
+static QJsonObject actionLatency(Priority priority)
+{
+    Worker worker(0, QByteArray(), QByteArray(), false);
+    Client *client = createClient(BENCHMARK_DEVICES);
+    QJsonObject state = client->handoff();
+    QByteArray key = randomData(16), iv = randomData(16), buffer(FRAME_BUFFER_SIZE, 0);
+    QString topic = client->devices().keys().value(2);
+    QList <QByteArray> frames;
+    QList <int> peers;
+    QAtomicInt actions, batches;
+    Histogram histogram;
+    AES128 aes;
+
+    delete client;
+
+    aes.init(key, iv);
+    state.insert("key", QString(key.toHex()));
+    state.insert("iv", QString(iv.toHex()));
+
+    for (const char *status : {"on", "off"})
+        frames.append(telemetryFrame(aes, topic, {{"status", status}, {"level", 128}, {"linkQuality", 120}}));
+
+    for (int i = 0; i < BENCHMARK_HUBS; i++)
+    {
+        int descriptors[2];
+
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, descriptors) < 0)
+            break;
+
+        state.insert("uniqueId", QString("bench-%1").arg(i));
+
+        client = new Client(Transport::create(descriptors[0], true));
+        client->restore(state);
+        client->moveToThread(worker.thread());
+
+        worker.post([i, client] (Worker *worker) { worker->attach(i + 1, "bench", client); QObject::disconnect(client, &Client::dataUpdated, worker, nullptr); });
+        peers.append(descriptors[1]);
+    }
+
+    for (int round = 0; round < BENCHMARK_ROUNDS && !peers.isEmpty(); round++)
+    {
+        int index = round % peers.count();
+        QString id = QString("bench-%1/%2/0").arg(index).arg(topic);
+        QJsonArray devices = {QJsonObject {{"id", id}, {"capabilities", QJsonArray {QJsonObject {{"type", "devices.capabilities.on_off"}, {"state", QJsonObject {{"instance", "on"}, {"value", round % 2 == 0}}}}}}}};
+        QElapsedTimer timer;
+
+        for (int i = 0; i < peers.count(); i++)
+            sink += write(peers.at(i), frames.at(round % 2).constData(), frames.at(round % 2).length());
+
+        for (int i = 0; i < BENCHMARK_STREAMS; i++)
+            worker.post([i] (Worker *worker) { sink += Yandex::devices(worker->clients(i % BENCHMARK_HUBS + 1)).count(); }, priority);
+
+        worker.post([&batches] (Worker *) { batches.ref(); }, priority);
+        timer.start();
+
+        worker.post([&histogram, &actions, index, round, devices, timer] (Worker *worker)
+        {
+            sink += Yandex::action(worker->clients(index + 1), devices, QString::number(round), timer).count();
+            histogram.observe(timer.nsecsElapsed() / 1000);
+            actions.ref();
+        });
+
+        while (actions.loadAcquire() <= round || batches.loadAcquire() <= round)
+            QThread::usleep(100);
+
+        while (read(peers.at(index), buffer.data(), buffer.length()) > 0);
+    }
+
+    for (int i = 0; i < peers.count(); i++)
+        close(peers.at(i));
+
+    qInfo().noquote() << QString("%1: p50 %2 ms, p99 %3 ms").arg(priority == Priority::Bulk ? "schedule/priority" : "schedule/fifo", -32).arg(histogram.percentile(0.5) * 1000, 0, 'f', 2).arg(histogram.percentile(0.99) * 1000, 0, 'f', 2);
+    return {{"hubs", peers.count()}, {"streams", BENCHMARK_STREAMS}, {"rounds", BENCHMARK_ROUNDS}, {"p50", histogram.percentile(0.5) * 1000}, {"p99", histogram.percentile(0.99) * 1000}};
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCommandLineParser parser;
+    QJsonObject json, memory, compression, scheduling, handoff;
+
+    parser.setApplicationDescription("HOMEd cloud server microbenchmarks");
+    parser.addHelpOption();
+    parser.addOptions({{"filter", "Run benchmarks matching the regular expression", "regexp", "."}, {"output", "Write JSON results to the file instead of stdout", "file"}});
+    parser.process(a);
+
+    Benchmark benchmark(parser.value("filter"));
+
+    for (int size : {16, 64, 256, 1024, 16384})
+    {
+        QByteArray data = randomData(size), key = randomData(16), iv = randomData(16);
+        AES128 aes;
+
+        aes.init(key, iv);
+
+        benchmark.run(QString("aes/encrypt/%1").arg(size), [&aes, &data] () { aes.cbcEncrypt(data); }, size);
+        benchmark.run(QString("aes/decrypt/%1").arg(size), [&aes, &data] () { aes.cbcDecrypt(data); }, size);
+    }
+
+    {
+        DH dh;
+        quint32 value = QRandomGenerator::global()->generate();
+
+        benchmark.run("dh/sharedKey", [&dh] () { sink += dh.sharedKey(); });
+        benchmark.run("dh/privateKey", [&dh, value] () { sink += dh.privateKey(value); });
+    }
+
+    for (int size : {256, 4096})
+    {
+        QByteArray data = randomData(size), frame = Client::encodeFrame(data);
+
+        benchmark.run(QString("frame/encode/%1").arg(size), [&data] () { sink += Client::encodeFrame(data).length(); }, size);
+        benchmark.run(QString("frame/decode/%1").arg(size), [&frame] () { sink += Client::decodeFrame(frame, frame.length() - 1).length(); }, size);
+    }
+
+    benchmark.run("expose/switch", [] () { sink += createEndpoint(Device(), 0, {"switch"}, {{"switch", "outlet"}})->capabilities().count(); });
+    benchmark.run("expose/climate", [] () { sink += createEndpoint(Device(), 0, {"temperature", "humidity", "pressure", "battery"}, {})->properties().count(); });
+
+    {
+        QMap <QString, QVariant> options = lightOptions();
+        benchmark.run("expose/light", [&options] () { sink += createEndpoint(Device(), 0, {"light"}, options)->capabilities().count(); });
+    }
+
+    {
+        QList <QString> exposes = {"switch", "light", "cover", "thermostat", "action", "contact", "gas", "occupancy", "smoke", "waterLeak", "vibration", "temperature", "pressure", "humidity", "co2", "pm1", "pm10", "pm25", "voc", "illuminance", "volume", "energy", "voltage", "current", "power", "fanMode", "heatMode", "swingMode", "battery", "batteryLow"};
+        QMap <QString, QVariant> options = worstOptions();
+
+        benchmark.run("expose/worst", [&exposes, &options] () { sink += createEndpoint(Device(), 0, exposes, options)->capabilities().count(); });
+    }
+
+    {
+        Capabilities::Color color(lightOptions());
+
+        color.data().insert("colorMode", true);
+        color.data().insert("color", QList <QVariant> {250, 30, 40});
+        benchmark.run("color/state/rgb", [&color] () { sink += color.state().count(); });
+
+        color.data().insert("colorMode", false);
+        color.data().insert("colorTemperature", 370);
+        benchmark.run("color/state/temperature", [&color] () { sink += color.state().count(); });
+    }
+
+    for (int count : {10, 100, 1000})
+    {
+        QMap <QString, Client*> clients = {{QString(), createClient(count)}};
+        QJsonArray queries;
+
+        for (auto it = clients.first()->devices().begin(); it != clients.first()->devices().end(); it++)
+            queries.append(QJsonObject {{"id", QString("/%1/0").arg(it.key())}});
+
+        benchmark.run(QString("discovery/%1").arg(count), [&clients] () { sink += QJsonDocument(QJsonObject {{"devices", Yandex::devices(clients)}}).toJson(QJsonDocument::Compact).length(); });
+        benchmark.run(QString("query/%1").arg(count), [&clients, &queries] () { sink += QJsonDocument(QJsonObject {{"devices", Yandex::query(clients, queries)}}).toJson(QJsonDocument::Compact).length(); });
+
+        {
+            QByteArray data = QJsonDocument(QJsonObject {{"devices", Yandex::devices(clients)}}).toJson(QJsonDocument::Compact), tail = "\"00000000-0000-0000-0000-000000000000\"}";
+            Compressed compressed(data);
+
+            benchmark.run(QString("compress/gzip/%1").arg(count), [&data] () { sink += Compressed::encode(Encoding::Gzip, data).length(); }, data.length());
+            benchmark.run(QString("compress/cached/%1").arg(count), [&compressed, &tail] () { sink += compressed.finish(Encoding::Gzip, tail).length(); }, data.length());
+
+            compression.insert(QString("discovery/%1").arg(count), QJsonObject {{"identity", data.length()}, {"gzip", Compressed::encode(Encoding::Gzip, data).length()}, {"deflate", Compressed::encode(Encoding::Deflate, data).length()}});
+        }
+
+        delete clients.first();
+    }
+
+    {
+        TimerWheel *wheel = TimerWheel::instance();
+        QList <quint64> ids;
+        QList <QTimer*> timers;
+        QTimer timer;
+        qint64 usage = residentMemory();
+
+        ids.reserve(BENCHMARK_OBJECTS);
+        timers.reserve(BENCHMARK_OBJECTS);
+
+        for (int i = 0; i < BENCHMARK_OBJECTS; i++)
+            ids.append(wheel->add(60000 + i, [] () {}));
+
+        memory.insert("timer/wheel", (residentMemory() - usage) / BENCHMARK_OBJECTS);
+        benchmark.run(QString("timer/wheel/%1").arg(BENCHMARK_OBJECTS), [wheel] () { wheel->cancel(wheel->add(30000, [] () {})); });
+
+        usage = residentMemory();
+
+        for (int i = 0; i < BENCHMARK_OBJECTS; i++)
+        {
+            timers.append(new QTimer);
+            timers.last()->start(60000 + i);
+        }
+
+        memory.insert("timer/qtimer", (residentMemory() - usage) / BENCHMARK_OBJECTS);
+        benchmark.run(QString("timer/qtimer/%1").arg(BENCHMARK_OBJECTS), [&timer] () { timer.start(30000); timer.stop(); });
+
+        for (int i = 0; i < ids.count(); i++)
+            wheel->cancel(ids.at(i));
+
+        qDeleteAll(timers);
+    }
+
+    connectionMemory(memory, false);
+    connectionMemory(memory, true);
+
+    if (QRegularExpression(parser.value("filter")).match("handoff").hasMatch())
+        handoff = connectionHandoff();
+
+    if (QRegularExpression(parser.value("filter")).match("schedule").hasMatch())
+    {
+        scheduling.insert("fifo", actionLatency(Priority::Interactive));
+        scheduling.insert("priority", actionLatency(Priority::Bulk));
+    }
+
+    json = {{"timestamp", QDateTime::currentDateTimeUtc().toString(Qt::ISODate)}, {"qt", qVersion()}, {"results", benchmark.results()}, {"memory", memory}, {"compression", compression}, {"scheduling", scheduling}, {"handoff", handoff}};
+
+    if (parser.isSet("output"))
+    {
+        QFile file(parser.value("output"));
+
+        if (!file.open(QFile::WriteOnly | QFile::Truncate))
+        {
+            qWarning() << "Can't open" << parser.value("output");
+            return 1;
+        }
+
+        file.write(QJsonDocument(json).toJson());
+        return 0;
+    }
+
+    QTextStream(stdout) << QJsonDocument(json).toJson();
+    return 0;
+}
@@ -5,34 +5,121 @@
 #include <QDebug>
 #include "client.h"
 
-Client::Client(QTcpSocket *socket) : QObject(nullptr), m_socket(socket), m_timer(new QTimer(this)), m_aes(new AES128), m_status(Status::Handshake)
+static Counter *framesIn = Metrics::instance()->counter("hub_frames_total", "direction=\"in\"");
+static Counter *framesOut = Metrics::instance()->counter("hub_frames_total", "direction=\"out\"");
+static Counter *bytesIn = Metrics::instance()->counter("hub_bytes_total", "direction=\"in\"");
+static Counter *bytesOut = Metrics::instance()->counter("hub_bytes_total", "direction=\"out\"");
+static Histogram *handshakeTime = Metrics::instance()->histogram("hub_handshake_seconds");
+static Histogram *callbackTime = Metrics::instance()->histogram("hub_frame_callback_seconds");
+static Histogram *publishTime = Metrics::instance()->histogram("action_publish_seconds");
+static Counter *expiredTraces = Metrics::instance()->counter("action_traces_expired_total");
+static Counter *coalescedPublishes = Metrics::instance()->counter("hub_publishes_coalesced_total");
+static Counter *overflowDisconnects = Metrics::instance()->counter("hub_write_overflow_total");
+static Gauge *blockedClients = Metrics::instance()->gauge("hub_clients_blocked");
+static Gauge *queuedRequests = Metrics::instance()->gauge("hub_write_queue_requests");
+static Counter *parseYields = Metrics::instance()->counter("hub_parse_yields_total");
+static QAtomicInteger <quint64> revisions;
+
+static const QList <QString> deviceTypes =
 {
-    int descriptor = m_socket->socketDescriptor(), keepAlive = 1, interval = 10, count = 3;
+    "camera", "cooking", "cooking.coffee_maker", "cooking.kettle", "cooking.multicooker", "dishwasher", "humidifier", "iron", "light", "media_device", "media_device.receiver", "media_device.tv", "media_device.tv_box",
+    "openable", "openable.curtain", "openable.door_lock", "openable.valve", "other", "pet_drinking_fountain", "pet_feeder", "purifier", "sensor", "sensor.button", "sensor.climate", "sensor.gas", "sensor.illumination",
+    "sensor.motion", "sensor.open", "sensor.smoke", "sensor.vibration", "sensor.water_leak", "smart_meter", "smart_meter.cold_water", "smart_meter.electricity", "smart_meter.gas", "smart_meter.heat", "smart_meter.hot_water",
+    "socket", "switch", "thermostat", "thermostat.ac", "vacuum_cleaner", "ventilation", "ventilation.fan", "washing_machine"
+};
+
+static QMap <QString, Histogram*> roundtripHistograms(void)
+{
+    QMap <QString, Histogram*> map;
+
+    for (int i = 0; i < deviceTypes.count(); i++)
+        map.insert(QString("devices.types.%1").arg(deviceTypes.at(i)), Metrics::instance()->histogram("action_roundtrip_seconds", QString("type=\"devices.types.%1\"").arg(deviceTypes.at(i))));
+
+    return map;
+}
+
+static const QMap <QString, Histogram*> roundtripTimes = roundtripHistograms();
+
+static const QList <QString> coreServices = {"automation", "cloud", "recorder", "web"};
+static const QList <QString> deviceServices = {"zigbee", "matter", "modbus"};
+
+Client::Client(Transport *transport) : QObject(nullptr), m_transport(transport), m_overflow(0), m_status(Status::Handshake), m_restored(false), m_scheduled(false), m_revision(revisions.fetchAndAddRelaxed(1) + 1)
+{
+    int descriptor = m_transport->descriptor(), keepAlive = 1, interval = 10, count = 3;
 
     setsockopt(descriptor, SOL_SOCKET, SO_KEEPALIVE, &keepAlive, sizeof(keepAlive));
     setsockopt(descriptor, SOL_TCP, TCP_KEEPIDLE, &interval, sizeof(interval));
     setsockopt(descriptor, SOL_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
     setsockopt(descriptor, SOL_TCP, TCP_KEEPCNT, &count, sizeof(count));
 
-    m_coreServices = {"automation", "cloud", "recorder", "web"};
-    m_deviceServices = {"zigbee", "matter", "modbus"};
+    m_transport->setParent(this);
 
-    m_socket->setParent(this);
+    connect(m_transport, &Transport::readyRead, this, &Client::readyRead);
+    connect(m_transport, &Transport::bytesWritten, this, &Client::drainQueue);
+    connect(m_transport, &Transport::disconnected, this, &Client::disconnected);
 
-    connect(m_socket, &QTcpSocket::readyRead, this, &Client::readyRead);
-    connect(m_socket, &QTcpSocket::disconnected, this, &Client::disconnected);
-    connect(m_timer, &QTimer::timeout, this, &Client::timeout);
-
-    m_timer->setSingleShot(true);
-    m_timer->start(AUTHORIZATION_TIMEOUT);
+    m_deadline = TimerWheel::instance()->add(AUTHORIZATION_TIMEOUT, [this] () { timeout(); });
+    m_elapsed.start();
 }
 
 Client::~Client(void)
 {
-    delete m_aes;
+    if (m_deadline)
+        TimerWheel::instance()->cancel(m_deadline);
+
+    if (m_overflow)
+    {
+        TimerWheel::instance()->cancel(m_overflow);
+        blockedClients->add(-1);
+    }
+
+    for (int i = 0; i < m_traces.count(); i++)
+        TimerWheel::instance()->cancel(m_traces.at(i).deadline);
+
+    queuedRequests->add(-m_queue.count());
     close();
 }
 
+QByteArray Client::encodeFrame(const QByteArray &buffer)
+{
+    QByteArray packet = QByteArray(1, 0x42);
+
+    for (int i = 0; i < buffer.length(); i++)
+    {
+        switch (buffer.at(i))
+        {
+            case 0x42: packet.append(0x44).append(0x62); break;
+            case 0x43: packet.append(0x44).append(0x63); break;
+            case 0x44: packet.append(0x44).append(0x64); break;
+            default:   packet.append(buffer.at(i)); break;
+        }
+    }
+
+    return packet.append(0x43);
+}
+
+QByteArray Client::decodeFrame(const QByteArray &data, int length)
+{
+    QByteArray buffer;
+    decodeFrame(data.constData(), length, buffer);
+    return buffer;
+}
+
+void Client::decodeFrame(const char *data, int length, QByteArray &buffer)
+{
+    buffer.resize(0);
+
+    for (int i = 0; i < length; i++)
+    {
+        switch (data[i])
+        {
+            case 0x42: buffer.resize(0); break;
+            case 0x44: buffer.append(data[++i] & 0xDF); break;
+            default:   buffer.append(data[i]); break;
+        }
+    }
+}
+
 void Client::publish(const Endpoint &endpoint, const QJsonObject &json)
 {
     QString topic = QString("td/").append(endpoint->device()->topic());
@@ -55,9 +142,135 @@ void Client::publish(const Endpoint &endpoint, const QJsonObject &json)
     }
 }
 
+void Client::trace(const Endpoint &endpoint, const Capability &capability, const QString &requestId, const QElapsedTimer &timer)
+{
+    ActionTrace trace = {requestId, endpoint->device()->name(), roundtripTimes.value(endpoint->type(), roundtripTimes.value("devices.types.other")), capability, timer, timer.nsecsElapsed() / 1000, 0};
+
+    trace.deadline = TimerWheel::instance()->add(ACTION_TRACE_TIMEOUT, [this, requestId, capability] () { expireTrace(requestId, capability); });
+    publishTime->observe(trace.published);
+    m_traces.append(trace);
+}
+
+void Client::authorize(void)
+{
+    m_transport->suspend();
+    m_status = Status::Transfer;
+}
+
+void Client::resume(void)
+{
+    if (!m_restored)
+        sendRequest("subscribe", "status/#");
+
+    m_status = Status::Ready;
+    m_transport->resume();
+    parseBuffer();
+}
+
 void Client::close(void)
 {
-    m_socket->abort();
+    m_transport->abort();
+}
+
+QJsonObject Client::handoff(void)
+{
+    QJsonArray devices;
+
+    while (!m_queue.isEmpty())
+    {
+        writeRequest(m_queue.takeFirst());
+        queuedRequests->add(-1);
+    }
+
+    m_transport->flush(HANDOFF_WRITE_TIMEOUT);
+    m_buffer.append(m_transport->read());
+
+    for (auto it = m_devices.begin(); it != m_devices.end(); it++)
+    {
+        const Device &device = it.value();
+        QJsonArray endpoints;
+
+        for (auto it = device->endpoints().begin(); it != device->endpoints().end(); it++)
+        {
+            const Endpoint &endpoint = it.value();
+            QJsonArray data;
+            QJsonObject values;
+
+            for (int i = 0; i < endpoint->capabilities().count(); i++)
+                data.append(QJsonObject::fromVariantMap(endpoint->capabilities().at(i)->data()));
+
+            for (auto it = endpoint->properties().begin(); it != endpoint->properties().end(); it++)
+                if (!it.value()->value().isNull())
+                    values.insert(it.key(), QJsonValue::fromVariant(it.value()->value()));
+
+            endpoints.append(QJsonObject {{"id", endpoint->id()}, {"numeric", endpoint->numeric()}, {"type", endpoint->type()}, {"exposes", QJsonArray::fromStringList(endpoint->exposes())}, {"options", QJsonObject::fromVariantMap(endpoint->options())}, {"data", data}, {"values", values}});
+        }
+
+        devices.append(QJsonObject {{"key", device->key()}, {"topic", device->topic()}, {"name", device->name()}, {"description", device->description()}, {"available", device->available()}, {"endpoints", endpoints}});
+    }
+
+    return {{"uniqueId", m_uniqueId}, {"key", QString(m_aes.key().toHex())}, {"iv", QString(m_aes.iv().toHex())}, {"buffer", QString(m_buffer.toBase64())}, {"devices", devices}};
+}
+
+void Client::restore(const QJsonObject &json)
+{
+    QJsonArray devices = json.value("devices").toArray();
+
+    m_aes.init(QByteArray::fromHex(json.value("key").toString().toUtf8()), QByteArray::fromHex(json.value("iv").toString().toUtf8()));
+    m_uniqueId = json.value("uniqueId").toString();
+    m_buffer = QByteArray::fromBase64(json.value("buffer").toString().toUtf8());
+
+    for (auto it = devices.begin(); it != devices.end(); it++)
+    {
+        QJsonObject item = it->toObject();
+        QJsonArray endpoints = item.value("endpoints").toArray();
+        Device device(new DeviceObject(item.value("key").toString(), item.value("topic").toString(), item.value("name").toString(), item.value("description").toString()));
+
+        device->setAvailable(item.value("available").toBool());
+
+        for (auto it = endpoints.begin(); it != endpoints.end(); it++)
+        {
+            QJsonObject json = it->toObject(), values = json.value("values").toObject();
+            QJsonArray exposes = json.value("exposes").toArray(), data = json.value("data").toArray();
+            Endpoint endpoint(new EndpointObject(static_cast <quint8> (json.value("id").toInt()), device, json.value("numeric").toBool()));
+
+            for (int i = 0; i < exposes.count(); i++)
+                endpoint->exposes().append(exposes.at(i).toString());
+
+            endpoint->options() = json.value("options").toObject().toVariantMap();
+            endpoint->setType(json.value("type").toString());
+            parseExposes(endpoint);
+
+            for (int i = 0; i < endpoint->capabilities().count() && i < data.count(); i++)
+            {
+                QMap <QString, QVariant> map = data.at(i).toObject().toVariantMap();
+
+                for (auto it = map.begin(); it != map.end(); it++)
+                    endpoint->capabilities().at(i)->data().insert(it.key(), it.value());
+            }
+
+            for (auto it = values.begin(); it != values.end(); it++)
+            {
+                const Property &property = endpoint->properties().value(it.key());
+
+                if (property.isNull())
+                    continue;
+
+                property->setValue(it.value().toVariant());
+            }
+
+            device->endpoints().insert(endpoint->id(), endpoint);
+        }
+
+        m_devices.insert(device->key(), device);
+    }
+
+    TimerWheel::instance()->cancel(m_deadline);
+    m_deadline = 0;
+    m_transport->suspend();
+    m_status = Status::Transfer;
+    m_restored = true;
+    m_revision = revisions.fetchAndAddRelaxed(1) + 1;
 }
 
 Device Client::findDevice(const QString &search)
@@ -69,6 +282,43 @@ Device Client::findDevice(const QString &search)
     return Device();
 }
 
+void Client::confirmTrace(const Capability &capability)
+{
+    for (auto it = m_traces.begin(); it != m_traces.end(); NULL)
+    {
+        qint64 time;
+
+        if (it->capability != capability)
+        {
+            it++;
+            continue;
+        }
+
+        time = it->timer.nsecsElapsed() / 1000;
+        it->roundtrip->observe(time);
+        TimerWheel::instance()->cancel(it->deadline);
+
+        if (time > ACTION_TRACE_THRESHOLD * 1000)
+            qWarning() << "Action" << it->requestId << "for" << QString("%1/%2").arg(m_uniqueId, it->device) << "confirmed in" << time / 1000 << "ms, published after" << it->published / 1000 << "ms";
+
+        it = m_traces.erase(it);
+    }
+}
+
+void Client::expireTrace(const QString &requestId, const Capability &capability)
+{
+    for (auto it = m_traces.begin(); it != m_traces.end(); it++)
+    {
+        if (it->requestId != requestId || it->capability != capability)
+            continue;
+
+        qWarning() << "Action" << requestId << "for" << QString("%1/%2").arg(m_uniqueId, it->device) << "not confirmed in" << ACTION_TRACE_TIMEOUT << "ms, published after" << it->published / 1000 << "ms";
+        expiredTraces->increment();
+        m_traces.erase(it);
+        return;
+    }
+}
+
 void Client::parseExposes(const Endpoint &endpoint)
 {
     // basic
@@ -295,37 +545,117 @@ void Client::parseExposes(const Endpoint &endpoint)
 void Client::sendRequest(const QString &action, const QString &topic, const QJsonObject &message)
 {
     QJsonObject json = {{"action", action}, {"topic", topic}};
-    QByteArray buffer, packet = QByteArray(1, 0x42);
 
     if (action == "publish" && !message.isEmpty())
         json.insert("message", message);
 
-    buffer = QJsonDocument(json).toJson(QJsonDocument::Compact);
+    if (m_queue.isEmpty() && m_transport->bytesToWrite() < WRITE_HIGH_WATERMARK)
+    {
+        writeRequest(json);
+        return;
+    }
+
+    if (action == "publish" && topic.startsWith("td/"))
+    {
+        for (int i = 0; i < m_queue.count(); i++)
+        {
+            QJsonObject &item = m_queue[i], pending;
+
+            if (item.value("topic").toString() != topic || item.value("action").toString() != action)
+                continue;
+
+            pending = item.value("message").toObject();
+
+            for (auto it = message.begin(); it != message.end(); it++)
+                pending.insert(it.key(), it.value());
+
+            item.insert("message", pending);
+            coalescedPublishes->increment();
+            return;
+        }
+    }
+
+    m_queue.append(json);
+    queuedRequests->add(1);
+
+    if (m_overflow)
+        return;
+
+    m_overflow = TimerWheel::instance()->add(WRITE_OVERFLOW_TIMEOUT, [this] () { overflow(); });
+    blockedClients->add(1);
+}
+
+void Client::writeRequest(const QJsonObject &json)
+{
+    QByteArray buffer = QJsonDocument(json).toJson(QJsonDocument::Compact), packet;
 
     if (buffer.length() % 16)
         buffer.append(16 - buffer.length() % 16, 0);
 
-    m_aes->cbcEncrypt(buffer);
+    m_aes.cbcEncrypt(buffer);
 
-    for (int i = 0; i < buffer.length(); i++)
+    packet = encodeFrame(buffer);
+    m_transport->write(packet);
+
+    framesOut->increment();
+    bytesOut->increment(packet.length());
+}
+
+void Client::overflow(void)
+{
+    m_overflow = 0;
+    blockedClients->add(-1);
+    overflowDisconnects->increment();
+
+    qWarning() << "Client" << m_uniqueId << "write queue stalled for" << WRITE_OVERFLOW_TIMEOUT << "ms with" << m_transport->bytesToWrite() << "bytes and" << m_queue.count() << "requests pending, closing connection";
+    close();
+}
+
+void Client::parseBuffer(void)
+{
+    static thread_local QByteArray buffer;
+    QElapsedTimer timer;
+    int offset = 0, length;
+
+    if (!buffer.capacity())
+        buffer.reserve(FRAME_BUFFER_SIZE);
+
+    timer.start();
+
+    while (m_status != Status::Transfer && (length = m_buffer.indexOf(0x43, offset)) > offset)
     {
-        switch (buffer.at(i))
+        decodeFrame(m_buffer.constData() + offset, length - offset, buffer);
+        offset = length + 1;
+        framesIn->increment();
+        parseData(buffer);
+
+        if (m_status != Status::Ready || timer.nsecsElapsed() < PARSE_TIME_SLICE)
+            continue;
+
+        if (!m_scheduled)
         {
-            case 0x42: packet.append(0x44).append(0x62); break;
-            case 0x43: packet.append(0x44).append(0x63); break;
-            case 0x44: packet.append(0x44).append(0x64); break;
-            default:   packet.append(buffer.at(i)); break;
+            QMetaObject::invokeMethod(this, [this] () { m_scheduled = false; parseBuffer(); }, Qt::QueuedConnection);
+            m_scheduled = true;
+            parseYields->increment();
         }
+
+        break;
     }
 
-    m_socket->write(packet.append(0x43));
+    if (offset)
+        m_buffer.remove(0, offset);
+
+    if (!m_buffer.isEmpty())
+        return;
+
+    m_buffer = QByteArray();
 }
 
 void Client::parseData(QByteArray &buffer)
 {
     QJsonObject json;
 
-    m_aes->cbcDecrypt(buffer);
+    m_aes.cbcDecrypt(buffer);
     json = QJsonDocument::fromJson(buffer.constData()).object();
 
     if (m_status == Status::Authorization)
@@ -333,15 +663,15 @@ void Client::parseData(QByteArray &buffer)
         m_uniqueId = json.value("uniqueId").toString();
         emit tokenReceived(QByteArray::fromHex(json.value("token").toString().toUtf8()));
 
-        if (!parent())
+        if (m_status != Status::Transfer)
         {
-            m_socket->close();
+            m_transport->close();
             return;
         }
 
-        sendRequest("subscribe", "status/#");
-        m_status = Status::Ready;
-        m_timer->stop();
+        TimerWheel::instance()->cancel(m_deadline);
+        m_deadline = 0;
+        handshakeTime->observe(m_elapsed.nsecsElapsed() / 1000);
     }
     else
     {
@@ -355,9 +685,11 @@ void Client::parseData(QByteArray &buffer)
             QJsonArray devices = message.value("devices").toArray();
             bool names = message.value("names").toBool(), check = false;
 
-            if (m_coreServices.contains(type))
+            if (coreServices.contains(type))
                 return;
 
+            m_revision = revisions.fetchAndAddRelaxed(1) + 1;
+
             for (auto it = devices.begin(); it != devices.end(); it++)
             {
                 QJsonObject item = it->toObject();
@@ -366,7 +698,7 @@ void Client::parseData(QByteArray &buffer)
                 if (name.isEmpty() || item.value("removed").toBool() || !item.value("cloud").toBool(true) || name == "HOMEd Coordinator")
                     continue;
 
-                switch (m_deviceServices.indexOf(type))
+                switch (deviceServices.indexOf(type))
                 {
                     case 0:  id = item.value("ieeeAddress").toString(); break;                                                  // zigbee
                     case 1:  id = item.value("nodeId").toString(); break;                                                       // matter
@@ -471,6 +803,8 @@ void Client::parseData(QByteArray &buffer)
             for (auto it = device->endpoints().begin(); it != device->endpoints().end(); it++)
                 parseExposes(it.value());
 
+            m_revision = revisions.fetchAndAddRelaxed(1) + 1;
+
             for (int i = 0; i < subscriptions.count(); i++)
                 sendRequest("subscribe", subscriptions.at(i));
 
@@ -513,6 +847,9 @@ void Client::parseData(QByteArray &buffer)
 
                         capability->data().insert(name, it.value());
                         capability->setUpdated(true);
+
+                        if (!m_traces.isEmpty())
+                            confirmTrace(capability);
                     }
 
                     if (!property.isNull() && property->value() != it.value() && (property->type() != "devices.properties.event" || property->events().contains(it.value().toString())))
@@ -524,13 +861,19 @@ void Client::parseData(QByteArray &buffer)
             }
 
             emit dataUpdated(device);
+            callbackTime->observe(m_elapsed.nsecsElapsed() / 1000);
         }
     }
 }
 
 void Client::readyRead(void)
 {
-    QByteArray data = m_socket->readAll();
+    QByteArray data = m_transport->read();
+
+    if (m_status == Status::Ready)
+        m_elapsed.restart();
+
+    bytesIn->increment(data.length());
 
     if (m_status == Status::Handshake)
     {
@@ -541,7 +884,7 @@ void Client::readyRead(void)
 
         if (data.length() < sizeof(hanshake))
         {
-            m_socket->close();
+            m_transport->close();
             return;
         }
 
@@ -551,46 +894,46 @@ void Client::readyRead(void)
         dh.setGenerator(qFromBigEndian(hanshake.generator));
 
         value = qToBigEndian(dh.sharedKey());
-        m_socket->write(QByteArray(reinterpret_cast <char*> (&value), sizeof(value)));
+        m_transport->write(QByteArray(reinterpret_cast <char*> (&value), sizeof(value)));
 
         key = qToBigEndian(dh.privateKey(qFromBigEndian(hanshake.sharedKey)));
         hash = QCryptographicHash::hash(QByteArray(reinterpret_cast <char*> (&key), sizeof(key)), QCryptographicHash::Md5);
 
-        m_aes->init(hash, QCryptographicHash::hash(hash, QCryptographicHash::Md5));
+        m_aes.init(hash, QCryptographicHash::hash(hash, QCryptographicHash::Md5));
         m_status = Status::Authorization;
     }
     else
     {
-        QByteArray buffer;
-        int length;
-
         m_buffer.append(data);
 
         if (m_buffer.length() > MAX_BUFFER_SIZE)
         {
-            m_socket->close();
+            m_transport->close();
             return;
         }
 
-        while ((length = m_buffer.indexOf(0x43)) > 0)
-        {
-            for (int i = 0; i < length; i++)
-            {
-                switch (m_buffer.at(i))
-                {
-                    case 0x42: buffer.clear(); break;
-                    case 0x44: buffer.append(m_buffer.at(++i) & 0xDF); break;
-                    default:   buffer.append(m_buffer.at(i)); break;
-                }
-            }
-
-            m_buffer.remove(0, length + 1);
-            parseData(buffer);
-        }
+        parseBuffer();
     }
 }
 
 void Client::timeout(void)
 {
+    m_deadline = 0;
     close();
 }
+
+void Client::drainQueue(void)
+{
+    while (!m_queue.isEmpty() && m_transport->bytesToWrite() < WRITE_HIGH_WATERMARK)
+    {
+        writeRequest(m_queue.takeFirst());
+        queuedRequests->add(-1);
+    }
+
+    if (!m_queue.isEmpty() || !m_overflow)
+        return;
+
+    TimerWheel::instance()->cancel(m_overflow);
+    m_overflow = 0;
+    blockedClients->add(-1);
+}
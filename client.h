@@ -3,15 +3,25 @@
 
 #define AUTHORIZATION_TIMEOUT   10000
 #define MAX_BUFFER_SIZE         (1024 * 1024)
+#define FRAME_BUFFER_SIZE       4096
+#define ACTION_TRACE_THRESHOLD  2000
+#define ACTION_TRACE_TIMEOUT    30000
+#define HANDOFF_WRITE_TIMEOUT   1000
+#define WRITE_HIGH_WATERMARK    (256 * 1024)
+#define WRITE_OVERFLOW_TIMEOUT  30000
+#define PARSE_TIME_SLICE        2000000
 
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QTcpServer>
-#include <QTcpSocket>
+#include <QElapsedTimer>
 #include <QTimer>
 #include <capability.h>
 #include "crypto.h"
+#include "metrics.h"
+#include "transport.h"
+#include "wheel.h"
 
 class EndpointObject;
 typedef QSharedPointer <EndpointObject> Endpoint;
@@ -88,6 +98,16 @@ private:
 
 };
 
+struct ActionTrace
+{
+    QString requestId, device;
+    Histogram *roundtrip;
+    Capability capability;
+    QElapsedTimer timer;
+    qint64 published;
+    quint64 deadline;
+};
+
 struct handshakeRequest
 {
     quint32 prime;
@@ -101,46 +121,75 @@ class Client : public QObject
 
 public:
 
-    Client(QTcpSocket *socket);
+    Client(Transport *transport);
     ~Client(void);
 
-    inline QAbstractSocket::SocketError socketError(void) { return m_socket->error(); }
+    inline QAbstractSocket::SocketError socketError(void) { return m_transport->error(); }
+    inline bool connected(void) { return m_transport->connected(); }
+    inline bool secure(void) { return m_transport->secure(); }
+    inline int descriptor(void) { return m_transport->descriptor(); }
+    inline qint64 bytesToWrite(void) { return m_transport->bytesToWrite(); }
+    inline quint64 revision(void) { return m_revision; }
     inline QString uniqueId(void) { return m_uniqueId; }
     inline QMap <QString, Device> &devices(void) { return m_devices; }
 
+    static QByteArray encodeFrame(const QByteArray &buffer);
+    static QByteArray decodeFrame(const QByteArray &data, int length);
+    static void decodeFrame(const char *data, int length, QByteArray &buffer);
+    static void parseExposes(const Endpoint &endpoint);
+
     void publish(const Endpoint &endpoint, const QJsonObject &json);
+    void trace(const Endpoint &endpoint, const Capability &capability, const QString &requestId, const QElapsedTimer &timer);
+
+    void authorize(void);
+    void resume(void);
     void close(void);
 
+    QJsonObject handoff(void);
+    void restore(const QJsonObject &json);
+
 private:
 
-    enum class Status
+    enum class Status : quint8
     {
         Handshake,
         Authorization,
+        Transfer,
         Ready
     };
 
-    QTcpSocket *m_socket;
-    QTimer *m_timer;
-    AES128 *m_aes;
+    Transport *m_transport;
+    QElapsedTimer m_elapsed;
+    AES128 m_aes;
 
-    QByteArray m_buffer;
+    quint64 m_deadline, m_overflow;
     Status m_status;
+    bool m_restored, m_scheduled;
+    quint64 m_revision;
+
+    QByteArray m_buffer;
     QString m_uniqueId;
 
-    QList <QString> m_coreServices, m_deviceServices;
     QMap <QString, Device> m_devices;
+    QList <ActionTrace> m_traces;
+
+    QList <QJsonObject> m_queue;
 
     Device findDevice(const QString &search);
+    void confirmTrace(const Capability &capability);
+    void expireTrace(const QString &requestId, const Capability &capability);
 
-    void parseExposes(const Endpoint &endpoint);
     void sendRequest(const QString &action, const QString &topic, const QJsonObject &message = QJsonObject());
+    void writeRequest(const QJsonObject &json);
+    void overflow(void);
+    void parseBuffer(void);
     void parseData(QByteArray &buffer);
+    void timeout(void);
 
 private slots:
 
     void readyRead(void);
-    void timeout(void);
+    void drainQueue(void);
 
 signals:
 
@@ -0,0 +1,255 @@
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QPointer>
+#include <QSaveFile>
+#include <QThread>
+#include "cluster.h"
+
+Cluster::Cluster(const QString &directory, const QString &address, const QByteArray &secret, QObject *parent, int descriptor) : QObject(parent), m_server(new QTcpServer(this)), m_timer(new QTimer(this)), m_directory(directory), m_address(address), m_secret(secret)
+{
+    Metrics *metrics = Metrics::instance();
+
+    m_forwardCounter = metrics->counter("cluster_requests_total", "direction=\"out\"");
+    m_failureCounter = metrics->counter("cluster_failures_total");
+    m_requestCounter = metrics->counter("cluster_requests_total", "direction=\"in\"");
+
+    m_clock.start();
+
+    if (!enabled())
+        return;
+
+    if (m_address.isEmpty() || m_secret.isEmpty() || !QDir().mkpath(QString("%1/nodes").arg(m_directory)))
+    {
+        qWarning() << "Cluster mode disabled, node address, secret or ownership directory is not available";
+        m_directory.clear();
+        return;
+    }
+
+    connect(m_server, &QTcpServer::newConnection, this, &Cluster::newConnection);
+
+    if (!(descriptor >= 0 ? m_server->setSocketDescriptor(descriptor) : m_server->listen(QHostAddress::Any, static_cast <quint16> (m_address.mid(m_address.lastIndexOf(':') + 1).toInt()))))
+    {
+        qWarning() << "Cluster RPC startup error:" << m_server->errorString();
+        m_directory.clear();
+        return;
+    }
+
+    connect(m_timer, &QTimer::timeout, this, &Cluster::updateHeartbeat);
+    m_timer->start(CLUSTER_HEARTBEAT_INTERVAL);
+    updateHeartbeat();
+
+    qDebug() << "Cluster node" << m_address << "using ownership directory" << m_directory;
+}
+
+Cluster::~Cluster(void)
+{
+    QList <qint64> list = m_owned.values();
+
+    for (int i = 0; i < list.count(); i++)
+        release(list.at(i));
+
+    if (!enabled())
+        return;
+
+    QFile::remove(nodeFile(m_address));
+}
+
+QString Cluster::owner(qint64 chat)
+{
+    QMutexLocker lock(&m_mutex);
+    qint64 now = m_clock.elapsed();
+    auto it = m_owners.find(chat);
+
+    if (!enabled())
+        return QString();
+
+    if (it == m_owners.end() || it->expire <= now)
+        it = m_owners.insert(chat, {read(chat), now + CLUSTER_CACHE_TIMEOUT});
+
+    if (it->address.isEmpty() || it->address == m_address || !alive(it->address, now))
+        return QString();
+
+    return it->address;
+}
+
+void Cluster::forward(const QString &address, QJsonObject json, const Reply &callback)
+{
+    QTcpSocket *socket = new QTcpSocket;
+    QTimer *timer = new QTimer(socket);
+
+    auto finish = [this, address, socket, timer, callback] (const QByteArray &data)
+    {
+        socket->disconnect();
+        timer->stop();
+        socket->abort();
+        socket->deleteLater();
+
+        if (data.isEmpty())
+        {
+            m_mutex.lock();
+            m_nodes.insert(address, {false, m_clock.elapsed() + CLUSTER_CACHE_TIMEOUT});
+            m_mutex.unlock();
+            m_failureCounter->increment();
+        }
+
+        callback(data);
+    };
+
+    json.insert("secret", QString(m_secret));
+
+    connect(socket, &QTcpSocket::connected, socket, [socket, json] () { socket->write(QJsonDocument(json).toJson(QJsonDocument::Compact).append('\n')); });
+    connect(socket, &QTcpSocket::readyRead, socket, [socket, finish] () { if (socket->canReadLine()) finish(socket->readLine().trimmed()); });
+    connect(socket, &QTcpSocket::stateChanged, socket, [finish] (QAbstractSocket::SocketState state) { if (state == QAbstractSocket::UnconnectedState) finish(QByteArray()); });
+    connect(timer, &QTimer::timeout, socket, [finish] () { finish(QByteArray()); });
+
+    m_forwardCounter->increment();
+
+    timer->setSingleShot(true);
+    timer->start(CLUSTER_REQUEST_TIMEOUT);
+
+    socket->connectToHost(address.mid(0, address.lastIndexOf(':')), static_cast <quint16> (address.mid(address.lastIndexOf(':') + 1).toInt()));
+}
+
+void Cluster::reply(QTcpSocket *socket, const QByteArray &data)
+{
+    QPointer <QTcpSocket> pointer = socket;
+
+    if (QThread::currentThread() != thread())
+    {
+        QMetaObject::invokeMethod(this, [this, pointer, data] () { reply(pointer.data(), data); }, Qt::QueuedConnection);
+        return;
+    }
+
+    if (!socket)
+        return;
+
+    socket->write(QByteArray(data).append('\n'));
+    socket->disconnectFromHost();
+}
+
+void Cluster::claim(qint64 chat)
+{
+    QSaveFile file(QString("%1/%2").arg(m_directory).arg(chat));
+
+    if (!enabled())
+        return;
+
+    if (!file.open(QFile::WriteOnly) || file.write(m_address.toUtf8()) < 0 || !file.commit())
+    {
+        qWarning() << "Cluster ownership update failed for chat" << chat << file.errorString();
+        return;
+    }
+
+    m_owned.insert(chat);
+
+    m_mutex.lock();
+    m_owners.insert(chat, {m_address, m_clock.elapsed() + CLUSTER_CACHE_TIMEOUT});
+    m_mutex.unlock();
+}
+
+void Cluster::release(qint64 chat)
+{
+    if (!enabled() || !m_owned.remove(chat))
+        return;
+
+    m_mutex.lock();
+    m_owners.remove(chat);
+    m_mutex.unlock();
+
+    if (read(chat) != m_address)
+        return;
+
+    QFile::remove(QString("%1/%2").arg(m_directory).arg(chat));
+}
+
+QString Cluster::read(qint64 chat)
+{
+    QFile file(QString("%1/%2").arg(m_directory).arg(chat));
+
+    if (!enabled() || !file.open(QFile::ReadOnly))
+        return QString();
+
+    return QString(file.readAll()).trimmed();
+}
+
+QString Cluster::nodeFile(const QString &address)
+{
+    return QString("%1/nodes/%2").arg(m_directory, address);
+}
+
+bool Cluster::alive(const QString &address, qint64 now)
+{
+    auto it = m_nodes.find(address);
+
+    if (it == m_nodes.end() || it->expire <= now)
+    {
+        QFileInfo info(nodeFile(address));
+        it = m_nodes.insert(address, {info.exists() && info.lastModified().msecsTo(QDateTime::currentDateTime()) < CLUSTER_HEARTBEAT_TIMEOUT, now + CLUSTER_CACHE_TIMEOUT});
+    }
+
+    return it->alive;
+}
+
+void Cluster::updateHeartbeat(void)
+{
+    QSaveFile file(nodeFile(m_address));
+    qint64 now = m_clock.elapsed();
+
+    if (!file.open(QFile::WriteOnly) || file.write(m_address.toUtf8()) < 0 || !file.commit())
+        qWarning() << "Cluster heartbeat update failed:" << file.errorString();
+
+    m_mutex.lock();
+
+    for (auto it = m_owners.begin(); it != m_owners.end(); NULL)
+    {
+        if (it->expire <= now)
+        {
+            it = m_owners.erase(it);
+            continue;
+        }
+
+        it++;
+    }
+
+    m_mutex.unlock();
+}
+
+void Cluster::newConnection(void)
+{
+    QTcpSocket *socket = m_server->nextPendingConnection();
+    QTimer *timer;
+
+    if (!socket)
+        return;
+
+    timer = new QTimer(socket);
+
+    connect(socket, &QTcpSocket::readyRead, this, &Cluster::readyRead);
+    connect(socket, &QTcpSocket::disconnected, socket, &QTcpSocket::deleteLater);
+    connect(timer, &QTimer::timeout, socket, &QTcpSocket::abort);
+
+    timer->setSingleShot(true);
+    timer->start(CLUSTER_REQUEST_TIMEOUT);
+}
+
+void Cluster::readyRead(void)
+{
+    QTcpSocket *socket = reinterpret_cast <QTcpSocket*> (sender());
+
+    while (socket->canReadLine())
+    {
+        QJsonObject json = QJsonDocument::fromJson(socket->readLine()).object();
+
+        if (json.value("secret").toString().toUtf8() != m_secret)
+        {
+            qWarning() << "Cluster request from" << socket->peerAddress().toString() << "rejected";
+            socket->abort();
+            return;
+        }
+
+        m_requestCounter->increment();
+        emit requestReceived(socket, json);
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#define CLUSTER_REQUEST_TIMEOUT     5000
+#define CLUSTER_HEARTBEAT_INTERVAL  5000
+#define CLUSTER_HEARTBEAT_TIMEOUT   15000
+#define CLUSTER_CACHE_TIMEOUT       2000
+
+#include <functional>
+#include <QJsonDocument>
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QMutex>
+#include <QSet>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+#include "metrics.h"
+
+typedef std::function <void (const QByteArray &data)> Reply;
+
+class Cluster : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    Cluster(const QString &directory, const QString &address, const QByteArray &secret, QObject *parent = nullptr, int descriptor = -1);
+    ~Cluster(void);
+
+    inline bool enabled(void) { return !m_directory.isEmpty(); }
+    inline int descriptor(void) { return static_cast <int> (m_server->socketDescriptor()); }
+
+    QString owner(qint64 chat);
+    void forward(const QString &address, QJsonObject json, const Reply &callback);
+    void reply(QTcpSocket *socket, const QByteArray &data);
+
+public slots:
+
+    void claim(qint64 chat);
+    void release(qint64 chat);
+
+private:
+
+    struct Owner
+    {
+        QString address;
+        qint64 expire;
+    };
+
+    struct Node
+    {
+        bool alive;
+        qint64 expire;
+    };
+
+    QTcpServer *m_server;
+    QTimer *m_timer;
+    QString m_directory, m_address;
+    QByteArray m_secret;
+
+    QElapsedTimer m_clock;
+    QMutex m_mutex;
+    QHash <qint64, Owner> m_owners;
+    QHash <QString, Node> m_nodes;
+
+    QSet <qint64> m_owned;
+    Counter *m_forwardCounter, *m_failureCounter, *m_requestCounter;
+
+    QString read(qint64 chat);
+    QString nodeFile(const QString &address);
+    bool alive(const QString &address, qint64 now);
+
+private slots:
+
+    void updateHeartbeat(void);
+    void newConnection(void);
+    void readyRead(void);
+
+signals:
+
+    void requestReceived(QTcpSocket *socket, const QJsonObject &json);
+
+};
+
+#endif
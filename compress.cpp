@@ -0,0 +1,158 @@
+#include <QtEndian>
+#include <QList>
+#include "compress.h"
+
+Compressed::Compressed(const QByteArray &data) : m_crc(0), m_adler(1), m_length(data.length()), m_failed(true)
+{
+    z_stream stream;
+
+    memset(&stream, 0, sizeof(stream));
+
+    if (deflateInit2(&stream, COMPRESSION_LEVEL, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return;
+
+    m_data.resize(static_cast <int> (deflateBound(&stream, static_cast <uLong> (data.length()))) + 16);
+
+    stream.next_in = reinterpret_cast <Bytef*> (const_cast <char*> (data.constData()));
+    stream.avail_in = static_cast <uInt> (data.length());
+    stream.next_out = reinterpret_cast <Bytef*> (m_data.data());
+    stream.avail_out = static_cast <uInt> (m_data.length());
+
+    if (deflate(&stream, Z_SYNC_FLUSH) != Z_OK || stream.avail_in)
+        m_data.clear();
+    else
+        m_data.resize(static_cast <int> (stream.total_out));
+
+    deflateEnd(&stream);
+    m_failed = m_data.isEmpty();
+
+    m_crc = static_cast <quint32> (crc32(0, reinterpret_cast <const Bytef*> (data.constData()), static_cast <uInt> (data.length())));
+    m_adler = static_cast <quint32> (adler32(1, reinterpret_cast <const Bytef*> (data.constData()), static_cast <uInt> (data.length())));
+}
+
+QByteArray Compressed::finish(Encoding encoding, const QByteArray &tail)
+{
+    quint32 crc = m_crc, adler = m_adler, value;
+    int offset = 0;
+    QByteArray buffer;
+
+    if (m_data.isEmpty())
+        return QByteArray();
+
+    buffer.reserve(m_data.length() + tail.length() + tail.length() / 65535 * 5 + 32);
+
+    switch (encoding)
+    {
+        case Encoding::Gzip:    buffer.append("\x1F\x8B\x08\x00\x00\x00\x00\x00\x00\x03", 10); break;
+        case Encoding::Deflate: buffer.append("\x78\x9C", 2); break;
+        default:                return QByteArray();
+    }
+
+    buffer.append(m_data);
+
+    do
+    {
+        quint16 length = static_cast <quint16> (qMin(tail.length() - offset, 65535)), header[2] = {qToLittleEndian(length), qToLittleEndian(static_cast <quint16> (~length))};
+
+        buffer.append(offset + length < tail.length() ? 0x00 : 0x01);
+        buffer.append(reinterpret_cast <char*> (header), sizeof(header));
+        buffer.append(tail.constData() + offset, length);
+
+        offset += length;
+    }
+    while (offset < tail.length());
+
+    if (!tail.isEmpty())
+    {
+        crc = static_cast <quint32> (crc32_combine(crc, crc32(0, reinterpret_cast <const Bytef*> (tail.constData()), static_cast <uInt> (tail.length())), tail.length()));
+        adler = static_cast <quint32> (adler32_combine(adler, adler32(1, reinterpret_cast <const Bytef*> (tail.constData()), static_cast <uInt> (tail.length())), tail.length()));
+    }
+
+    if (encoding == Encoding::Gzip)
+    {
+        value = qToLittleEndian(crc);
+        buffer.append(reinterpret_cast <char*> (&value), sizeof(value));
+        value = qToLittleEndian(static_cast <quint32> (m_length + tail.length()));
+        buffer.append(reinterpret_cast <char*> (&value), sizeof(value));
+    }
+    else
+    {
+        value = qToBigEndian(adler);
+        buffer.append(reinterpret_cast <char*> (&value), sizeof(value));
+    }
+
+    return buffer;
+}
+
+Encoding Compressed::negotiate(const QString &header)
+{
+    QList <QString> list = header.toLower().split(',');
+    Encoding result = Encoding::Identity;
+
+    for (int i = 0; i < list.count(); i++)
+    {
+        QList <QString> item = list.at(i).split(';');
+        QString name = item.value(0).trimmed(), quality = item.value(1).trimmed();
+
+        if (quality.startsWith("q=") && quality.mid(2).toDouble() <= 0)
+            continue;
+
+        if (name == "gzip" || name == "*")
+            return Encoding::Gzip;
+
+        if (name == "deflate")
+            result = Encoding::Deflate;
+    }
+
+    return result;
+}
+
+QString Compressed::name(Encoding encoding)
+{
+    switch (encoding)
+    {
+        case Encoding::Gzip:    return "gzip";
+        case Encoding::Deflate: return "deflate";
+        default:                return "identity";
+    }
+}
+
+QByteArray Compressed::encode(Encoding encoding, const QByteArray &data)
+{
+    Compressed compressed(data);
+    return compressed.isEmpty() ? QByteArray() : compressed.finish(encoding);
+}
+
+Compressor::Compressor(Encoding encoding) : m_valid(false)
+{
+    memset(&m_stream, 0, sizeof(m_stream));
+    m_valid = deflateInit2(&m_stream, COMPRESSION_LEVEL, Z_DEFLATED, encoding == Encoding::Gzip ? MAX_WBITS + 16 : MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+}
+
+Compressor::~Compressor(void)
+{
+    if (!m_valid)
+        return;
+
+    deflateEnd(&m_stream);
+}
+
+QByteArray Compressor::write(const QByteArray &data, bool last)
+{
+    QByteArray buffer;
+
+    if (!m_valid)
+        return buffer;
+
+    buffer.resize(static_cast <int> (deflateBound(&m_stream, static_cast <uLong> (data.length()))) + 32);
+
+    m_stream.next_in = reinterpret_cast <Bytef*> (const_cast <char*> (data.constData()));
+    m_stream.avail_in = static_cast <uInt> (data.length());
+    m_stream.next_out = reinterpret_cast <Bytef*> (buffer.data());
+    m_stream.avail_out = static_cast <uInt> (buffer.length());
+
+    deflate(&m_stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    buffer.resize(buffer.length() - static_cast <int> (m_stream.avail_out));
+
+    return buffer;
+}
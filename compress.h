@@ -0,0 +1,61 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#define COMPRESSION_THRESHOLD   1024
+#define COMPRESSION_LEVEL       6
+
+#include <zlib.h>
+#include <QByteArray>
+#include <QString>
+
+enum class Encoding
+{
+    Identity,
+    Gzip,
+    Deflate
+};
+
+class Compressed
+{
+
+public:
+
+    Compressed(void) : m_crc(0), m_adler(1), m_length(0), m_failed(false) {}
+    Compressed(const QByteArray &data);
+
+    inline bool isEmpty(void) { return m_data.isEmpty(); }
+    inline bool failed(void) { return m_failed; }
+
+    QByteArray finish(Encoding encoding, const QByteArray &tail = QByteArray());
+
+    static Encoding negotiate(const QString &header);
+    static QString name(Encoding encoding);
+    static QByteArray encode(Encoding encoding, const QByteArray &data);
+
+private:
+
+    QByteArray m_data;
+    quint32 m_crc, m_adler;
+    qint64 m_length;
+    bool m_failed;
+
+};
+
+class Compressor
+{
+
+public:
+
+    Compressor(Encoding encoding);
+    ~Compressor(void);
+
+    QByteArray write(const QByteArray &data, bool last = false);
+
+private:
+
+    z_stream m_stream;
+    bool m_valid;
+
+};
+
+#endif
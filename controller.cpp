@@ -1,23 +1,26 @@
+#include <QCoreApplication>
 #include <QCryptographicHash>
-#include <QDir>
 #include <QRandomGenerator>
+#include <unistd.h>
 #include "controller.h"
 
-Controller::Controller(QObject *parent) : QObject(parent), m_db(QSqlDatabase::addDatabase("QSQLITE")), m_settings(new QSettings("/etc/homed/homed-cloud-server.conf", QSettings::IniFormat, this)), m_codeTimer(new QTimer(this)), m_statsTimer(new QTimer(this)), m_server(new QTcpServer(this)), m_http(new HTTP(m_settings, this)), m_aes(new AES128), m_apiCount(0), m_eventCount(0), m_clientCount(0), m_descriptorCount(0)
+Controller::Controller(const QString &configFile, QObject *parent) : QObject(parent), m_settings(new QSettings(configFile, QSettings::IniFormat, this)), m_statsTimer(new QTimer(this)), m_server(new TransportServer(m_settings->value("server/transport").toString() == "native", this)), m_http(nullptr), m_admin(nullptr), m_httpLocal(nullptr), m_adminLocal(nullptr), m_assets(nullptr), m_database(nullptr), m_cluster(nullptr), m_upgrade(nullptr), m_watchdog(nullptr), m_aes(new AES128), m_loaded(false), m_accepted(false), m_apiCount(0), m_eventCount(0), m_clientCount(0)
 {
-    QSqlQuery query(m_db);
+    Metrics *metrics = Metrics::instance();
+    quint16 port = static_cast <quint16> (m_settings->value("http/port", 8084).toInt());
+    QSslConfiguration tls;
+    int threads, descriptor, connections;
 
-    if (!m_server->listen(QHostAddress::Any, static_cast <quint16> (m_settings->value("server/port", 8042).toInt())))
-    {
-        qWarning() << "Cloud server startup error:" << m_server->errorString();
-        return;
-    }
+    m_startup.start();
 
-    m_db.setDatabaseName(m_settings->value("server/database").toString());
+    m_upgrade = new Upgrade(m_settings->value("upgrade/socket").toString(), this);
+    m_upgrade->receive();
 
-    if (!m_db.open())
+    descriptor = m_upgrade->descriptor("hub");
+
+    if (!(descriptor >= 0 ? m_server->setSocketDescriptor(descriptor) : m_server->listen(QHostAddress::Any, static_cast <quint16> (m_settings->value("server/port", 8042).toInt()))))
     {
-        qWarning() << "Database open error" << m_db.lastError().text();
+        qWarning() << "Cloud server startup error:" << m_server->errorString();
         return;
     }
 
@@ -32,41 +35,159 @@ Controller::Controller(QObject *parent) : QObject(parent), m_db(QSqlDatabase::ad
     m_botSecret = m_settings->value("bot/secret").toByteArray();
     m_rrdPath = m_settings->value("rrd/path").toByteArray();
 
-    m_aes->init(m_clientSecret, QCryptographicHash::hash(m_clientSecret, QCryptographicHash::Md5));
-    query.exec("SELECT chat, name, hash, clientToken, accessToken, refreshToken, tokenExpire FROM users");
+    m_assets = new Assets(m_path, this);
+    m_assets->add("logo.png", "image/png", "public, max-age=86400");
+    m_assets->add("login.html", "text/html; charset=utf-8", "no-store", 5);
 
-    while (query.next())
+    m_apiCounter = metrics->counter("api_requests_total");
+    m_discoveryCounter = metrics->counter("callbacks_total", "type=\"discovery\"");
+    m_stateCounter = metrics->counter("callbacks_total", "type=\"state\"");
+    m_shedCounter = metrics->counter("http_requests_shed_total");
+
+    m_userGauge = metrics->gauge("users");
+    m_clientGauge = metrics->gauge("hub_clients");
+    m_connectionGauge = metrics->gauge("hub_connections");
+    m_queueGauge = metrics->gauge("hub_write_queue_bytes");
+    m_databaseGauge = metrics->gauge("database_queue_depth");
+    m_memoryGauge = metrics->gauge("process_resident_memory_bytes");
+
+    if (m_settings->value("admin/port", 0).toInt())
     {
-        qint64 id = query.value(0).toLongLong();
-        User user(new UserObject);
+        m_admin = new HTTP(static_cast <quint16> (m_settings->value("admin/port").toInt()), false, this, m_upgrade->descriptor("admin"));
+        connect(m_admin, &HTTP::requestReceived, this, [this] (Request &request) { adminRequestReceived(m_admin, request); });
+    }
 
-        user->setName(query.value(1).toByteArray());
-        user->setHash(query.value(2).toByteArray());
-        user->setClientToken(QByteArray::fromHex(query.value(3).toByteArray()));
-        user->setAccessToken(QByteArray::fromHex(query.value(4).toByteArray()));
-        user->setRefreshToken(QByteArray::fromHex(query.value(5).toByteArray()));
-        user->setTokenExpire(query.value(6).toLongLong());
+    if (!m_settings->value("admin/socket").toString().isEmpty())
+    {
+        m_adminLocal = new HTTP(m_settings->value("admin/socket").toString(), this, m_upgrade->descriptor("admin-socket"));
+        connect(m_adminLocal, &HTTP::requestReceived, this, [this] (Request &request) { adminRequestReceived(m_adminLocal, request); });
+    }
+
+#ifdef RRD_SUPPORT
+    m_rrd = m_rrdPath.isEmpty() ? nullptr : new RRD(m_rrdPath);
+#else
+    if (!m_rrdPath.isEmpty())
+        qWarning() << "RRD support is not compiled in, statistics will be available on the admin port only";
+#endif
 
-        m_users.insert(id, user);
+    m_cluster = new Cluster(m_settings->value("cluster/directory").toString(), m_settings->value("cluster/address").toString(), m_settings->value("cluster/secret").toByteArray(), this, m_upgrade->descriptor("cluster"));
+    connect(m_cluster, &Cluster::requestReceived, this, &Controller::clusterRequest);
+
+    threads = m_settings->value("server/threads", 0).toInt();
+
+    if (threads <= 0)
+        threads = QThread::idealThreadCount();
+
+    for (int i = 0; i < threads; i++)
+    {
+        Worker *worker = new Worker(i, m_skillId, m_skillToken, m_debug);
+        connect(worker, &Worker::userAttached, m_cluster, &Cluster::claim);
+        connect(worker, &Worker::userDetached, m_cluster, &Cluster::release);
+        m_workers.append(worker);
     }
 
-    connect(m_codeTimer, &QTimer::timeout, this, &Controller::clearCodes);
+    m_watchdog = new Watchdog(m_settings->value("watchdog/shed", 0).toInt(), m_settings->value("watchdog/pause", 0).toInt(), m_settings->value("watchdog/stall", WATCHDOG_STALL).toInt(), this);
+    m_watchdog->watch(m_watchdog, "main");
+
+    for (int i = 0; i < m_workers.count(); i++)
+        m_watchdog->watch(m_workers.at(i), QString("worker-%1").arg(i));
+
+    connect(m_watchdog, &Watchdog::levelChanged, this, &Controller::levelChanged);
+    m_watchdog->start();
+
+    m_database = new Database(m_settings->value("server/database").toString(), m_settings->value("database/interval", DATABASE_COMMIT_INTERVAL).toInt());
+    m_aes->init(m_clientSecret, QCryptographicHash::hash(m_clientSecret, QCryptographicHash::Md5));
+
+    if (!m_settings->value("database/background", true).toBool())
+        while (!m_loaded)
+            loadUsers(true);
+
+    connect(m_database, &Database::usersAvailable, this, &Controller::usersAvailable);
     connect(m_statsTimer, &QTimer::timeout, this, &Controller::updateStats);
-    connect(m_http, &HTTP::requestReceived, this, &Controller::requestReceived);
     connect(m_server, &QTcpServer::newConnection, this, &Controller::newConnection);
 
-    m_codeTimer->start(1000);
+    tls = TLS::configuration(m_settings->value("tls/certificate").toString(), m_settings->value("tls/key").toString());
 
-    if (!m_rrdPath.isEmpty())
-        m_statsTimer->start(10000);
+    if (!tls.isNull() && m_settings->value("tls/hub", false).toBool())
+    {
+        if (m_server->native())
+            qWarning() << "Native transport does not support TLS, hub connections will use qt transport";
+
+        m_server->setSslConfiguration(tls);
+    }
+
+    if (tls.isNull() || !m_settings->value("tls/http", false).toBool())
+        tls = QSslConfiguration();
+
+    threads = m_settings->value("http/threads", 0).toInt();
+    connections = m_settings->value("http/connections", HTTP_ADDRESS_LIMIT).toInt();
+
+    descriptor = m_upgrade->descriptor("http");
+
+    if (threads <= 0)
+    {
+        m_http = new HTTP(port, false, this, descriptor);
+        m_http->setSslConfiguration(tls);
+        m_http->setAddressLimit(connections);
+        connect(m_http, &HTTP::requestReceived, this, [this] (Request &request) { requestReceived(m_http, request); });
+    }
+    else if (descriptor >= 0)
+        ::close(descriptor);
 
-    qDebug() << "Cloud server listening on port" << m_server->serverPort();
+    if (!m_settings->value("http/socket").toString().isEmpty())
+    {
+        m_httpLocal = new HTTP(m_settings->value("http/socket").toString(), this, m_upgrade->descriptor("http-socket"));
+        connect(m_httpLocal, &HTTP::requestReceived, this, [this] (Request &request) { requestReceived(m_httpLocal, request); });
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+        QThread *thread = new QThread;
+
+        thread->setObjectName(QString("http-%1").arg(i));
+
+        connect(thread, &QThread::started, [this, thread, port, tls, connections] ()
+        {
+            HTTP *http = new HTTP(port, true);
+            http->setSslConfiguration(tls);
+            http->setAddressLimit(connections);
+            connect(http, &HTTP::requestReceived, this, [this, http] (Request &request) { requestReceived(http, request); }, Qt::DirectConnection);
+            connect(thread, &QThread::finished, http, &HTTP::deleteLater);
+        });
+
+        m_httpThreads.append(thread);
+        thread->start();
+    }
+
+    for (int i = 0; i < m_upgrade->clients().count(); i++)
+        restoreClient(m_upgrade->clients().at(i));
+
+    m_upgrade->clients().clear();
+    m_upgrade->listen();
+
+    connect(m_upgrade, &Upgrade::requested, this, &Controller::upgradeRequested);
+
+    m_statsTimer->start(10000);
+
+    qDebug() << "Cloud server listening on port" << m_server->serverPort() << "with" << (m_server->native() ? "native" : "qt") << "transport";
 }
 
 Controller::~Controller()
 {
-    m_db.close();
+    for (int i = 0; i < m_httpThreads.count(); i++)
+    {
+        m_httpThreads.at(i)->quit();
+        m_httpThreads.at(i)->wait();
+    }
+
+    qDeleteAll(m_httpThreads);
+    qDeleteAll(m_workers);
+    delete m_database;
     delete m_aes;
+
+#ifdef RRD_SUPPORT
+    delete m_rrd;
+#endif
 }
 
 QByteArray Controller::randomData(int length)
@@ -79,84 +200,539 @@ QByteArray Controller::randomData(int length)
     return data;
 }
 
-void Controller::storeTokens(const User &user)
+qint64 Controller::residentMemory(void)
 {
-    QSqlQuery query(m_db);
-    query.exec(QString("UPDATE users SET accessToken = '%1', refreshToken = '%2', tokenExpire = %3, timestamp = %4 WHERE name = '%5'").arg(user->accessToken().toHex(), user->refreshToken().toHex()).arg(user->tokenExpire()).arg(QDateTime::currentSecsSinceEpoch()).arg(user->name().constData()));
+    QFile file("/proc/self/statm");
+
+    if (!file.open(QFile::ReadOnly))
+        return 0;
+
+    return QString(file.readAll()).split(0x20).value(1).toLongLong() * sysconf(_SC_PAGESIZE);
 }
 
-User Controller::findUser(const QByteArray &name)
+void Controller::storeTokens(UserData *user)
 {
-    for (auto it = m_users.begin(); it != m_users.end(); it++)
-        if (it.value()->name() == name)
-            return it.value();
+    m_database->storeTokens(m_users.name(user), user->accessToken.toByteArray(), user->refreshToken.toByteArray(), user->tokenExpire);
+}
 
-    return User();
+Worker *Controller::worker(qint64 chat)
+{
+    return m_workers.at(qHash(chat) % m_workers.count());
+}
+
+void Controller::reply(HTTP *http, Request request, const QByteArray &data, Encoding encoding, const Producer &producer)
+{
+    QMap <QString, QString> headers = {{"Content-Type", "application/json"}};
+
+    if (producer)
+    {
+        http->sendStream(request, 200, headers, producer);
+        m_apiCounter->increment();
+        return;
+    }
+
+    if (encoding != Encoding::Identity)
+    {
+        headers.insert("Content-Encoding", Compressed::name(encoding));
+        headers.insert("Vary", "Accept-Encoding");
+    }
+
+    http->sendResponse(request, 200, headers, data);
+    m_apiCounter->increment();
 }
 
-User Controller::findUser(const QString &header)
+void Controller::loadUsers(bool wait)
+{
+    QList <UserRecord> list;
+
+    if (m_loaded)
+        return;
+
+    m_loaded = !m_database->fetchUsers(list, wait);
+
+    for (int i = 0; i < list.count(); i++)
+    {
+        if (m_users.find(list.at(i).chat) || m_removed.contains(list.at(i).chat))
+            continue;
+
+        insertUser(list.at(i));
+    }
+
+    if (!m_loaded)
+        return;
+
+    m_removed.clear();
+    qDebug() << "Users table loaded in" << m_startup.elapsed() << "ms," << m_users.count() << "users total, resident memory" << residentMemory() / 1024 << "KiB";
+}
+
+void Controller::insertUser(const UserRecord &record)
+{
+    UserData *user = m_users.find(record.chat);
+
+    if (record.name.length() > NAME_LIMIT)
+    {
+        qWarning() << "User" << record.chat << "name is longer than" << NAME_LIMIT << "bytes, skipped";
+        return;
+    }
+
+    if (!user)
+        user = m_users.insert(record.chat);
+
+    m_users.setName(user, record.name);
+    m_users.setHash(user, record.hash);
+    m_users.setClientToken(user, record.clientToken);
+    m_users.setAccessToken(user, record.accessToken);
+    m_users.setRefreshToken(user, record.refreshToken);
+    user->tokenExpire = record.tokenExpire;
+}
+
+void Controller::removeUser(qint64 chat)
+{
+    worker(chat)->post([chat] (Worker *worker) { worker->detach(chat); });
+    m_users.remove(chat);
+
+    if (m_loaded)
+        return;
+
+    m_removed.insert(chat);
+}
+
+bool Controller::lookupUser(Database::Lookup lookup, const QVariant &value, UserRecord &record)
+{
+    QString key = QString("%1:%2").arg(static_cast <int> (lookup)).arg(value.toString());
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    m_missLock.lock();
+
+    if (m_misses.value(key) > now)
+    {
+        m_missLock.unlock();
+        return false;
+    }
+
+    m_missLock.unlock();
+
+    if (m_database->findUser(lookup, value, record))
+        return true;
+
+    m_missLock.lock();
+
+    if (m_misses.count() >= LOOKUP_MISS_LIMIT)
+    {
+        for (auto it = m_misses.begin(); it != m_misses.end(); NULL)
+            it = it.value() > now ? it + 1 : m_misses.erase(it);
+
+        if (m_misses.count() >= LOOKUP_MISS_LIMIT)
+            m_misses.clear();
+    }
+
+    m_misses.insert(key, now + LOOKUP_MISS_TIMEOUT);
+    m_missLock.unlock();
+
+    return false;
+}
+
+UserData *Controller::findUser(Database::Lookup lookup, const QVariant &value, const std::function <UserData *(void)> &find)
+{
+    UserData *user = find();
+    UserRecord record;
+    bool found;
+
+    if (user || (m_loaded && !m_cluster->enabled()))
+        return user;
+
+    m_lock.unlock();
+    found = lookupUser(lookup, value, record);
+    m_lock.lockForWrite();
+
+    if ((user = find()) || !found || m_removed.contains(record.chat))
+        return user;
+
+    insertUser(record);
+    return find();
+}
+
+bool Controller::authorize(const QString &header, qint64 &chat, QByteArray &name)
 {
     QList <QString> list = header.split(0x20);
     QByteArray accessToken = QByteArray::fromHex(list.value(1).toUtf8());
+    UserRecord record;
+    UserData *user;
+    bool result = false;
 
     if (list.value(0) != "Bearer")
-        return User();
+        return false;
 
     m_aes->cbcDecrypt(accessToken);
+    m_lock.lockForRead();
+    user = m_users.findByAccessToken(accessToken);
+
+    if (!user && (!m_loaded || m_cluster->enabled()))
+    {
+        m_lock.unlock();
+
+        if (!lookupUser(Database::Lookup::AccessToken, QString(accessToken.toHex()), record))
+            return false;
 
-    for (auto it = m_users.begin(); it != m_users.end(); it++)
-        if (it.value()->accessToken() == accessToken && it.value()->tokenExpire() >= QDateTime::currentSecsSinceEpoch())
-            return it.value();
+        m_lock.lockForWrite();
+        user = m_users.findByAccessToken(accessToken);
 
-    return User();
+        if (!user && !m_removed.contains(record.chat))
+        {
+            insertUser(record);
+            user = m_users.findByAccessToken(accessToken);
+        }
+    }
+
+    if (user && user->tokenExpire >= QDateTime::currentSecsSinceEpoch())
+    {
+        chat = user->chat;
+        name = m_users.name(user);
+        result = true;
+    }
+
+    m_lock.unlock();
+    return result;
 }
 
-void Controller::clearCodes(void)
+UserData *Controller::findUser(const QString &header)
 {
-    for (auto it = m_codes.begin(); it != m_codes.end(); NULL)
+    QList <QString> list = header.split(0x20);
+    QByteArray accessToken = QByteArray::fromHex(list.value(1).toUtf8());
+    UserData *user;
+
+    if (list.value(0) != "Bearer")
+        return nullptr;
+
+    m_aes->cbcDecrypt(accessToken);
+    user = findUser(Database::Lookup::AccessToken, QString(accessToken.toHex()), [this, &accessToken] () { return m_users.findByAccessToken(accessToken); });
+
+    return user && user->tokenExpire >= QDateTime::currentSecsSinceEpoch() ? user : nullptr;
+}
+
+void Controller::dispatch(const QString &url, qint64 chat, const QByteArray &name, const QString &requestId, const QString &body, const QElapsedTimer &timer, Encoding encoding, const Response &callback, bool forward, bool stream)
+{
+    QString address = forward ? m_cluster->owner(chat) : QString();
+    Priority priority = url.endsWith("/devices") ? Priority::Bulk : Priority::Interactive;
+
+    if (!address.isEmpty())
     {
-        if (it.value()->codeExpire() < QDateTime::currentSecsSinceEpoch())
+        QJsonObject json = {{"url", url}, {"chat", QString::number(chat)}, {"name", name.constData()}, {"requestId", requestId}, {"body", body}};
+
+        m_cluster->forward(address, json, [this, url, chat, name, requestId, body, timer, encoding, callback, stream, address] (const QByteArray &data)
         {
-            it = m_codes.erase(it);
-            continue;
+            if (data.isEmpty())
+            {
+                qWarning() << "Cluster node" << address << "is not available, handling" << name << "request locally";
+                dispatch(url, chat, name, requestId, body, timer, encoding, callback, false, stream);
+                return;
+            }
+
+            callback(data, Encoding::Identity, Producer());
+        });
+
+        return;
+    }
+
+    worker(chat)->post([this, url, chat, name, requestId, body, timer, encoding, callback, stream] (Worker *worker)
+    {
+        QString type = url.mid(url.lastIndexOf('/') + 1);
+        QJsonObject json = {{"request_id", requestId}}, payload;
+        UserObject *object = type == "devices" ? worker->object(chat) : nullptr;
+        QByteArray data, tail;
+
+        if (stream && (type == "devices" || type == "query"))
+        {
+            QMap <QString, Client*> clients = worker->clients(chat);
+            QJsonArray queries;
+            int count = 0;
+
+            if (type == "query")
+            {
+                queries = QJsonDocument::fromJson(body.toUtf8()).object().value("devices").toArray();
+                count = queries.count();
+            }
+            else
+            {
+                for (auto it = clients.begin(); it != clients.end(); it++)
+                    for (auto jt = it.value()->devices().begin(); jt != it.value()->devices().end(); jt++)
+                        count += jt.value()->endpoints().count();
+            }
+
+            if (count >= STREAM_THRESHOLD)
+            {
+                if (m_debug)
+                    qDebug() << name << type << "reply streamed for" << count << "items";
+
+                callback(QByteArray(), Encoding::Identity, producer(worker, type, chat, name, requestId, queries));
+                return;
+            }
+        }
+
+        if (object)
+        {
+            Discovery &discovery = object->discovery();
+            QMap <QString, quint64> revisions;
+
+            for (auto it = object->clients().begin(); it != object->clients().end(); it++)
+                revisions.insert(it.key(), it.value()->revision());
+
+            if (discovery.prefix.isEmpty() || discovery.name != name || discovery.revisions != revisions)
+            {
+                discovery.name = name;
+                discovery.revisions = revisions;
+                discovery.prefix = QJsonDocument(QJsonObject {{"payload", QJsonObject {{"user_id", name.constData()}, {"devices", Yandex::devices(object->clients())}}}}).toJson(QJsonDocument::Compact);
+                discovery.prefix.chop(1);
+                discovery.prefix.append(",\"request_id\":");
+                discovery.compressed = Compressed();
+            }
+
+            tail = jsonString(requestId).append('}');
+            data = QByteArray(discovery.prefix).append(tail);
+        }
+        else
+        {
+            if (type == "query")
+                payload = {{"devices", Yandex::query(worker->clients(chat), QJsonDocument::fromJson(body.toUtf8()).object().value("devices").toArray())}};
+            else if (type == "action")
+                payload = {{"devices", Yandex::action(worker->clients(chat), QJsonDocument::fromJson(body.toUtf8()).object().value("payload").toObject().value("devices").toArray(), requestId, timer)}};
+            else
+                payload = {{"user_id", name.constData()}, {"devices", Yandex::devices(worker->clients(chat))}};
+
+            json.insert("payload", payload);
+            data = QJsonDocument(json).toJson(QJsonDocument::Compact);
+        }
+
+        if (m_debug)
+        {
+            if (!body.isEmpty())
+                qDebug() << name << type << "request:" << body.toUtf8().constData();
+
+            qDebug() << name << type << "reply:" << data.constData();
+        }
+
+        if (object && encoding != Encoding::Identity && data.length() >= COMPRESSION_THRESHOLD)
+        {
+            Discovery &discovery = object->discovery();
+            QByteArray compressed;
+
+            if (discovery.compressed.isEmpty() && !discovery.compressed.failed())
+                discovery.compressed = Compressed(discovery.prefix);
+
+            compressed = discovery.compressed.finish(encoding, tail);
+
+            if (!compressed.isEmpty())
+            {
+                callback(compressed, encoding, Producer());
+                return;
+            }
         }
 
-        it++;
+        callback(data, Encoding::Identity, Producer());
+    }, priority);
+}
+
+Producer Controller::producer(Worker *target, const QString &type, qint64 chat, const QByteArray &name, const QString &requestId, const QJsonArray &queries)
+{
+    QSharedPointer <Cursor> cursor(new Cursor {QString(), QString(), 0, 0, false, false});
+
+    return [target, type, chat, name, requestId, queries, cursor] (const Chunk &chunk)
+    {
+        target->post([type, chat, name, requestId, queries, cursor, chunk] (Worker *worker)
+        {
+            QMap <QString, Client*> clients = worker->clients(chat);
+            QByteArray data;
+
+            if (cursor->finished)
+            {
+                chunk(QByteArray());
+                return;
+            }
+
+            if (!cursor->started)
+            {
+                data = "{\"payload\":{\"devices\":[";
+                cursor->started = true;
+            }
+
+            while (data.length() < STREAM_CHUNK_SIZE)
+            {
+                QJsonArray devices;
+                bool done;
+
+                if (type == "query")
+                {
+                    if (cursor->index < queries.count())
+                        devices = Yandex::query(clients, QJsonArray {queries.at(cursor->index++)});
+
+                    done = cursor->index >= queries.count();
+                }
+                else
+                {
+                    auto it = clients.lowerBound(cursor->client);
+
+                    while (it != clients.end())
+                    {
+                        Client *client = it.value();
+                        auto jt = it.key() == cursor->client ? client->devices().upperBound(cursor->device) : client->devices().begin();
+
+                        if (jt != client->devices().end())
+                        {
+                            Yandex::device(client, jt.value(), devices);
+                            cursor->client = it.key();
+                            cursor->device = jt.key();
+                            break;
+                        }
+
+                        if (++it == clients.end())
+                            break;
+
+                        cursor->client = it.key();
+                        cursor->device.clear();
+                    }
+
+                    done = it == clients.end();
+                }
+
+                for (int i = 0; i < devices.count(); i++)
+                {
+                    if (cursor->count++)
+                        data.append(',');
+
+                    data.append(QJsonDocument(devices.at(i).toObject()).toJson(QJsonDocument::Compact));
+                }
+
+                if (!done)
+                    continue;
+
+                data.append(type == "query" ? QByteArray("]}") : QByteArray("],\"user_id\":").append(jsonString(name)).append('}'));
+                data.append(",\"request_id\":").append(jsonString(requestId)).append('}');
+                cursor->finished = true;
+                break;
+            }
+
+            chunk(data);
+        }, type == "query" ? Priority::Interactive : Priority::Bulk);
+    };
+}
+
+QByteArray Controller::jsonString(const QString &value)
+{
+    QByteArray data = QJsonDocument(QJsonArray {value}).toJson(QJsonDocument::Compact);
+    return data.mid(1, data.length() - 2);
+}
+
+void Controller::restoreClient(const Handoff &handoff)
+{
+    Transport *transport = Transport::create(handoff.descriptor, m_server->native());
+    qint64 chat = handoff.state.value("chat").toString().toLongLong();
+    QByteArray name;
+    UserData *user;
+    Client *client;
+    Worker *target;
+
+    if (!transport)
+        return;
+
+    client = new Client(transport);
+    m_connectionGauge->add(1);
+
+    m_lock.lockForWrite();
+    user = findUser(Database::Lookup::Chat, chat, [this, chat] () { return m_users.find(chat); });
+
+    if (user)
+        name = m_users.name(user);
+
+    m_lock.unlock();
+
+    if (!user)
+    {
+        m_connectionGauge->add(-1);
+        delete client;
+        return;
     }
+
+    client->restore(handoff.state);
+    target = worker(chat);
+
+    client->moveToThread(target->thread());
+    target->post([chat, name, client] (Worker *worker) { worker->attach(chat, name, client); });
 }
 
-void Controller::updateStats(void)
+void Controller::usersAvailable(void)
+{
+    QWriteLocker lock(&m_lock);
+    loadUsers(false);
+}
+
+void Controller::updateMetrics(void)
 {
-    quint32 clients = 0, descriptors = QDir("/proc/self/fd").count() - 2;
-    quint64 time = QDateTime::currentSecsSinceEpoch();
+    qint64 clients = 0, queue = 0;
+
+    for (int i = 0; i < m_workers.count(); i++)
+    {
+        clients += m_workers.at(i)->clientCount();
+        queue += m_workers.at(i)->queueBytes();
+    }
 
-    for (auto it = m_users.begin(); it != m_users.end(); it++)
-        clients += it.value()->clients().count();
+    m_lock.lockForRead();
+    m_userGauge->set(m_users.count());
+    m_lock.unlock();
 
-    system(QString("rrdcreate %1/user.rrd --no-overwrite --step 10 DS:data:GAUGE:3600:U:U RRA:AVERAGE:0.5:1:8640 RRA:AVERAGE:0.5:60:1008 RRA:AVERAGE:0.5:360:744 RRA:AVERAGE:0.5:2160:1460 > /dev/null &").arg(m_rrdPath.constData()).toUtf8());
-    system(QString("rrdupdate %1/user.rrd %2:%3 > /dev/null &").arg(m_rrdPath.constData()).arg(time - time % 10).arg(m_users.count()).toUtf8());
+    m_clientGauge->set(clients);
+    m_queueGauge->set(queue);
+    m_databaseGauge->set(m_database->pending());
+    m_memoryGauge->set(residentMemory());
+}
 
-    system(QString("rrdcreate %1/client.rrd --no-overwrite --step 10 DS:data:GAUGE:3600:U:U RRA:AVERAGE:0.5:1:8640 RRA:AVERAGE:0.5:60:1008 RRA:AVERAGE:0.5:360:744 RRA:AVERAGE:0.5:2160:1460 > /dev/null &").arg(m_rrdPath.constData()).toUtf8());
-    system(QString("rrdupdate %1/client.rrd %2:%3 > /dev/null &").arg(m_rrdPath.constData()).arg(time - time % 10).arg(clients).toUtf8());
+void Controller::updateStats(void)
+{
+    quint64 api = m_apiCounter->value(), events = m_discoveryCounter->value() + m_stateCounter->value();
+    qint64 time = QDateTime::currentSecsSinceEpoch();
 
-    system(QString("rrdcreate %1/api.rrd --no-overwrite --step 10 DS:data:GAUGE:3600:U:U RRA:AVERAGE:0.5:1:8640 RRA:AVERAGE:0.5:60:1008 RRA:AVERAGE:0.5:360:744 RRA:AVERAGE:0.5:2160:1460 > /dev/null &").arg(m_rrdPath.constData()).toUtf8());
-    system(QString("rrdupdate %1/api.rrd %2:%3 > /dev/null &").arg(m_rrdPath.constData()).arg(time - time % 10).arg(m_apiCount).toUtf8());
+    updateMetrics();
 
-    system(QString("rrdcreate %1/event.rrd --no-overwrite --step 10 DS:data:GAUGE:3600:U:U RRA:AVERAGE:0.5:1:8640 RRA:AVERAGE:0.5:60:1008 RRA:AVERAGE:0.5:360:744 RRA:AVERAGE:0.5:2160:1460 > /dev/null &").arg(m_rrdPath.constData()).toUtf8());
-    system(QString("rrdupdate %1/event.rrd %2:%3 > /dev/null &").arg(m_rrdPath.constData()).arg(time - time % 10).arg(m_eventCount).toUtf8());
+#ifdef RRD_SUPPORT
+    if (m_rrd)
+    {
+        m_rrd->update("user", time, m_userGauge->value());
+        m_rrd->update("client", time, m_clientGauge->value());
+        m_rrd->update("api", time, api - m_apiCount);
+        m_rrd->update("event", time, events - m_eventCount);
+    }
+#else
+    Q_UNUSED(time);
+#endif
 
-    if (clients != m_clientCount || descriptors != m_descriptorCount)
+    if (m_clientGauge->value() != m_clientCount)
+    {
+        qDebug() << QString("Clients: %1, connections: %2").arg(m_clientGauge->value()).arg(m_connectionGauge->value());
+        m_clientCount = m_clientGauge->value();
+    }
+
+    m_apiCount = api;
+    m_eventCount = events;
+}
+
+void Controller::adminRequestReceived(HTTP *http, Request &request)
+{
+    if (request.url() == "/metrics")
     {
-        qDebug() << QString("Clients: %1, used descriptors: %2").arg(clients).arg(descriptors);
-        m_clientCount = clients;
-        m_descriptorCount = descriptors;
+        if (request.method() != "GET")
+        {
+            http->sendResponse(request, 405);
+            return;
+        }
+
+        updateMetrics();
+        http->sendResponse(request, 200, {{"Content-Type", "text/plain; version=0.0.4"}}, Metrics::instance()->exposition());
+        return;
     }
 
-    m_apiCount = 0;
-    m_eventCount = 0;
+    http->sendResponse(request, 404);
 }
 
-void Controller::requestReceived(Request &request)
+void Controller::requestReceived(HTTP *http, Request &request)
 {
     if (request.url() == "/telegram")
     {
@@ -164,23 +740,24 @@ void Controller::requestReceived(Request &request)
 
         if (!m_botSecret.isEmpty() && request.headers().value("X-Telegram-Bot-Api-Secret-Token") != m_botSecret)
         {
-            m_http->sendResponse(request, 403);
+            http->sendResponse(request, 403);
             return;
         }
 
         if (chat.value("type").toString() == "private" && !from.value("is_bot").toBool())
         {
+            QWriteLocker lock(&m_lock);
             QList <QString> list = {"/start", "/renew", "/remove", "/confirm", "/cancel", "/getid"};
             QString command = json.value("text").toString(), message;
             qint64 id = chat.value("id").toVariant().toLongLong();
             bool update = false, remove = false;
-            auto it = m_users.find(id);
+            UserData *user = findUser(Database::Lookup::Chat, id, [this, id] () { return m_users.find(id); });
 
             switch (list.indexOf(command))
             {
                 case 0: // start
 
-                    if (it != m_users.end())
+                    if (user)
                         break;
 
                     message = "Credentials created.\n\n";
@@ -189,10 +766,10 @@ void Controller::requestReceived(Request &request)
 
                 case 1: // renew
 
-                    if (it != m_users.end())
+                    if (user)
                     {
                         message = "Are you really want to get new credentials?\nSend /confirm or /cancel.";
-                        it.value()->setBotStatus(BotStatus::Renew);
+                        user->botStatus = BotStatus::Renew;
                         break;
                     }
 
@@ -202,10 +779,10 @@ void Controller::requestReceived(Request &request)
 
                 case 2: // remove
 
-                    if (it != m_users.end())
+                    if (user)
                     {
                         message = "Are you really want to remove your credentials?\nSend /confirm or /cancel.";
-                        it.value()->setBotStatus(BotStatus::Remove);
+                        user->botStatus = BotStatus::Remove;
                         break;
                     }
 
@@ -214,10 +791,10 @@ void Controller::requestReceived(Request &request)
 
                 case 3: // confirm
 
-                    if (it == m_users.end())
+                    if (!user)
                         break;
 
-                    switch (it.value()->botStatus())
+                    switch (user->botStatus)
                     {
                         case BotStatus::Renew:
                             message = "Credentials updated.\n\n";
@@ -237,11 +814,11 @@ void Controller::requestReceived(Request &request)
 
                 case 4: // cancel
 
-                    if (it == m_users.end() || it.value()->botStatus() == BotStatus::Idle)
+                    if (!user || user->botStatus == BotStatus::Idle)
                         break;
 
                     message = "Action cancelled.";
-                    it.value()->setBotStatus(BotStatus::Idle);
+                    user->botStatus = BotStatus::Idle;
                     break;
 
                 case 5: // getid
@@ -252,27 +829,38 @@ void Controller::requestReceived(Request &request)
             if (update)
             {
                 QByteArray salt = randomData(16), password = randomData(8).toHex();
-                QSqlQuery query(m_db);
 
-                if (it == m_users.end())
-                    it = m_users.insert(id, User(new UserObject));
+                if (!user)
+                    user = m_users.insert(id);
+
+                m_removed.remove(id);
 
-                it.value()->setName(QByteArray("user_").append(randomData(5).toHex()));
-                it.value()->setHash(salt.toHex().append(QCryptographicHash::hash(QByteArray(salt).append(password), QCryptographicHash::Md5).toHex()));
-                it.value()->setClientToken(randomData(32));
-                it.value()->setAccessToken(QByteArray());
-                it.value()->setRefreshToken(QByteArray());
-                it.value()->setTokenExpire(0);
+                m_users.setName(user, QByteArray("user_").append(randomData(5).toHex()));
+                m_users.setHash(user, salt.toHex().append(QCryptographicHash::hash(QByteArray(salt).append(password), QCryptographicHash::Md5).toHex()));
+                m_users.setClientToken(user, randomData(32));
+                m_users.setAccessToken(user, QByteArray());
+                m_users.setRefreshToken(user, QByteArray());
+                user->tokenExpire = 0;
 
-                message.append(QString("Username:\n`%1`\n\nPassword:\n`%2`\n\nClient token:\n`%3`").arg(it.value()->name(), password, it.value()->clientToken().toHex()));
-                query.exec(QString("INSERT INTO users (chat, name, hash, clientToken, timestamp) VALUES (%1, '%2', '%3', '%4', %5) ON CONFLICT (chat) DO UPDATE SET name = excluded.name, hash = excluded.hash, clientToken = excluded.clientToken, accessToken = NULL, refreshToken = NULL, tokenExpire = NULL, timestamp = excluded.timestamp").arg(id).arg(it.value()->name(), it.value()->hash(), it.value()->clientToken().toHex()).arg(QDateTime::currentSecsSinceEpoch()));
-                it.value()->setBotStatus(BotStatus::Idle);
+                message.append(QString("Username:\n`%1`\n\nPassword:\n`%2`\n\nClient token:\n`%3`").arg(m_users.name(user), password, user->clientToken.toByteArray().toHex()));
+                m_database->insertUser(id, m_users.name(user), m_users.hash(user), user->clientToken.toByteArray());
+
+                worker(id)->post([id, name = m_users.name(user)] (Worker *worker)
+                {
+                    UserObject *object = worker->object(id);
+
+                    if (!object)
+                        return;
+
+                    object->setName(name);
+                });
+
+                user->botStatus = BotStatus::Idle;
             }
             else if (remove)
             {
-                QSqlQuery query(m_db);
-                m_users.erase(it);
-                query.exec(QString("DELETE FROM users WHERE chat = %1").arg(id));
+                removeUser(id);
+                m_database->removeUser(id);
             }
 
             if (!message.isEmpty())
@@ -282,17 +870,20 @@ void Controller::requestReceived(Request &request)
             }
         }
 
-        m_http->sendResponse(request, 200);
+        http->sendResponse(request, 200);
         return;
     }
     else if (request.url() == "/logo.png")
     {
-        QFile file(QString("%1/logo.png").arg(m_path.constData()));
+        Asset asset = m_assets->asset("logo.png");
 
-        if (file.open(QFile::ReadOnly))
+        if (asset)
         {
-            m_http->sendResponse(request, 200, {{"Content-Type", "image/png"}}, file.readAll());
-            file.close();
+            if (asset->match(request.headers().value("If-None-Match")))
+                http->sendResponse(request, 304, asset->notModified(), QByteArray());
+            else
+                http->sendResponse(request, 200, asset->headers(), asset->data());
+
             return;
         }
     }
@@ -300,72 +891,73 @@ void Controller::requestReceived(Request &request)
     {
         if (request.method() == "GET")
         {
-            QFile file(QString("%1/login.html").arg(m_path.constData()));
+            Asset asset = m_assets->asset("login.html");
 
-            if (file.open(QFile::ReadOnly))
+            if (asset)
             {
-                QString data = QString(file.readAll().constData()).arg(request.data().value("client_id"), request.data().value("redirect_uri"), request.data().value("state"), request.data().value("username"), request.data().value("password"));
-                m_http->sendResponse(request, 200, {{"Content-Type", "text/html"}}, data.toUtf8());
-                file.close();
+                QByteArray data = asset->render({request.data().value("client_id"), request.data().value("redirect_uri"), request.data().value("state"), request.data().value("username"), request.data().value("password")});
+                http->sendResponse(request, 200, {{"Content-Type", "text/html"}, {"Cache-Control", "no-store"}}, data);
                 return;
             }
         }
         else if (request.method() == "POST")
         {
-            const User &user = findUser(request.data().value("username").toUtf8());
-            QByteArray salt, code;
+            QWriteLocker lock(&m_lock);
+            QByteArray name = request.data().value("username").toUtf8(), salt, code;
+            UserData *user = findUser(Database::Lookup::Name, QString(name), [this, &name] () { return m_users.findByName(name); });
 
             if (request.data().value("client_id").toUtf8() != m_clientId)
             {
-                m_http->sendResponse(request, 403);
+                http->sendResponse(request, 403);
                 return;
             }
 
-            if (user.isNull())
+            if (!user)
             {
-                m_http->sendResponse(request, 301, {{"Location", QString("/login?%1").arg(request.body())}});
+                http->sendResponse(request, 301, {{"Location", QString("/login?%1").arg(request.body())}});
                 return;
             }
 
-            salt = QByteArray::fromHex(user->hash().mid(0, 32));
+            salt = QByteArray::fromHex(m_users.hash(user).mid(0, 32));
 
-            if (user->hash() != salt.toHex().append(QCryptographicHash::hash(QByteArray(salt).append(request.data().value("password").toUtf8()), QCryptographicHash::Md5).toHex()))
+            if (m_users.hash(user) != salt.toHex().append(QCryptographicHash::hash(QByteArray(salt).append(request.data().value("password").toUtf8()), QCryptographicHash::Md5).toHex()))
             {
-                m_http->sendResponse(request, 301, {{"Location", QString("/login?%1").arg(request.body())}});
+                http->sendResponse(request, 301, {{"Location", QString("/login?%1").arg(request.body())}});
                 return;
             }
 
-            user->setCodeExpire(QDateTime::currentSecsSinceEpoch() + CODE_EXPIRE_TIMEOUT);
-            qDebug() << user->name() << "logged in";
+            qDebug() << name << "logged in";
 
             code = randomData(32);
-            m_codes.insert(code, user);
+            m_codes.insert(code, user->chat);
+            TimerWheel::instance()->add(CODE_EXPIRE_TIMEOUT * 1000, [this, code] () { QWriteLocker lock(&m_lock); m_codes.remove(code); });
             m_aes->cbcEncrypt(code);
 
-            m_http->sendResponse(request, 301, {{"Location", QString("%1?state=%2&code=%3").arg(request.data().value("redirect_uri"), request.data().value("state"), code.toHex())}});
+            http->sendResponse(request, 301, {{"Location", QString("%1?state=%2&code=%3").arg(request.data().value("redirect_uri"), request.data().value("state"), code.toHex())}});
             return;
         }
         else
         {
-            m_http->sendResponse(request, 405);
+            http->sendResponse(request, 405);
             return;
         }
     }
     else if (request.url() == "/refresh" || request.url() == "/token")
     {
+        QWriteLocker lock(&m_lock);
         QByteArray secret = QByteArray::fromHex(request.data().value("client_secret").toUtf8()), accessToken, refreshToken;
         AES128 aes;
-        User user;
+        UserData *user;
 
         if (request.method() != "POST")
         {
-            m_http->sendResponse(request, 405);
+            http->sendResponse(request, 405);
             return;
         }
 
         if (request.data().value("client_id").toUtf8() != m_clientId || request.data().value("grant_type") != (request.url() == "/refresh" ? "refresh_token" : "authorization_code"))
         {
-            m_http->sendResponse(request, 403);
+            http->sendResponse(request, 403);
             return;
         }
 
@@ -375,467 +967,291 @@ void Controller::requestReceived(Request &request)
         {
             refreshToken = QByteArray::fromHex(request.data().value("refresh_token").toUtf8());
             aes.cbcDecrypt(refreshToken);
-
-            for (auto it = m_users.begin(); it != m_users.end(); it++)
-            {
-                if (it.value()->refreshToken() == refreshToken)
-                {
-                    user = it.value();
-                    break;
-                }
-            }
+            user = findUser(Database::Lookup::RefreshToken, QString(refreshToken.toHex()), [this, &refreshToken] () { return m_users.findByRefreshToken(refreshToken); });
         }
         else
         {
             QByteArray code = QByteArray::fromHex(request.data().value("code").toUtf8());
             aes.cbcDecrypt(code);
-            user = m_codes.value(code);
-            m_codes.remove(code);
+            user = m_codes.contains(code) ? m_users.find(m_codes.take(code)) : nullptr;
         }
 
-        if (user.isNull())
+        if (!user)
         {
-            m_http->sendResponse(request, 401);
+            http->sendResponse(request, 401);
             return;
         }
 
-        qDebug() << user->name() << "token" << (request.url() == "/refresh" ? "refreshed" : "issued");
+        qDebug() << m_users.name(user) << "token" << (request.url() == "/refresh" ? "refreshed" : "issued");
 
-        user->setAccessToken(randomData(32));
-        user->setRefreshToken(randomData(32));
-        user->setTokenExpire(QDateTime::currentSecsSinceEpoch() + TOKEN_EXPIRE_TIMEOUT);
+        m_users.setAccessToken(user, randomData(32));
+        m_users.setRefreshToken(user, randomData(32));
+        user->tokenExpire = QDateTime::currentSecsSinceEpoch() + TOKEN_EXPIRE_TIMEOUT;
         storeTokens(user);
 
-        accessToken = user->accessToken();
-        refreshToken = user->refreshToken();
+        accessToken = user->accessToken.toByteArray();
+        refreshToken = user->refreshToken.toByteArray();
 
         m_aes->cbcEncrypt(accessToken);
         m_aes->cbcEncrypt(refreshToken);
 
-        m_http->sendResponse(request, 200, {{"Content-Type", "application/json"}}, QJsonDocument(QJsonObject {{"access_token", accessToken.toHex().constData()}, {"refresh_token", refreshToken.toHex().constData()}, {"token_type", "Bearer"}, {"expires_in", TOKEN_EXPIRE_TIMEOUT}}).toJson(QJsonDocument::Compact));
+        http->sendResponse(request, 200, {{"Content-Type", "application/json"}}, QJsonDocument(QJsonObject {{"access_token", accessToken.toHex().constData()}, {"refresh_token", refreshToken.toHex().constData()}, {"token_type", "Bearer"}, {"expires_in", TOKEN_EXPIRE_TIMEOUT}}).toJson(QJsonDocument::Compact));
         return;
     }
     else if (request.url() == "/api/v1.0")
     {
         if (request.method() != "HEAD")
         {
-            m_http->sendResponse(request, 405);
+            http->sendResponse(request, 405);
             return;
         }
 
-        m_http->sendResponse(request, 200);
+        http->sendResponse(request, 200);
         return;
     }
     else if (request.url() == "/api/v1.0/user/unlink")
     {
-        const User &user = findUser(request.headers().value("Authorization"));
+        QWriteLocker lock(&m_lock);
+        UserData *user = findUser(request.headers().value("Authorization"));
 
         if (request.method() != "POST")
         {
-            m_http->sendResponse(request, 405);
+            http->sendResponse(request, 405);
             return;
         }
 
-        if (user.isNull())
+        if (!user)
         {
-            m_http->sendResponse(request, 401);
+            http->sendResponse(request, 401);
             return;
         }
 
-        user->setAccessToken(QByteArray());
-        user->setRefreshToken(QByteArray());
-        user->setTokenExpire(0);
+        m_users.setAccessToken(user, QByteArray());
+        m_users.setRefreshToken(user, QByteArray());
+        user->tokenExpire = 0;
 
-        qDebug() << user->name() << "unlinked";
+        qDebug() << m_users.name(user) << "unlinked";
         storeTokens(user);
 
-        m_http->sendResponse(request, 200, {{"Content-Type", "application/json"}}, QJsonDocument(QJsonObject {{"request_id", request.headers().value("X-Request-Id")}}).toJson(QJsonDocument::Compact));
+        http->sendResponse(request, 200, {{"Content-Type", "application/json"}}, QJsonDocument(QJsonObject {{"request_id", request.headers().value("X-Request-Id")}}).toJson(QJsonDocument::Compact));
         return;
     }
     else if (request.url() == "/api/v1.0/user/devices")
     {
-        const User &user = findUser(request.headers().value("Authorization"));
-        QJsonArray devices;
-        QJsonObject json;
+        QString requestId = request.headers().value("X-Request-Id"), body;
+        QByteArray name;
+        qint64 chat;
 
         if (request.method() != "GET")
         {
-            m_http->sendResponse(request, 405);
+            http->sendResponse(request, 405);
             return;
         }
 
-        if (user.isNull())
+        if (Watchdog::level() != Watchdog::Level::Normal)
         {
-            m_http->sendResponse(request, 401);
+            http->sendResponse(request, 503, {{"Retry-After", QString::number(WATCHDOG_RETRY_AFTER)}});
+            m_shedCounter->increment();
             return;
         }
 
-        for (auto it = user->clients().begin(); it != user->clients().end(); it++)
+        if (!authorize(request.headers().value("Authorization"), chat, name))
         {
-            Client *client = it.value();
-
-            for (auto it = client->devices().begin(); it != client->devices().end(); it++)
-            {
-                const Device &device = it.value();
-
-                for (auto it = device->endpoints().begin(); it != device->endpoints().end(); it++)
-                {
-                    const Endpoint &endpoint = it.value();
-                    QJsonArray capabilities, properties;
-
-                    for (int i = 0; i < endpoint->capabilities().count(); i++)
-                    {
-                        const Capability &capability = endpoint->capabilities().at(i);
-                        QJsonObject item = {{"type", capability->type()}, {"retrievable", true}, {"reportable", true}, {"state", capability->state()}};
-
-                        if (!capability->parameters().isEmpty())
-                            item.insert("parameters", QJsonObject::fromVariantMap(capability->parameters()));
-
-                        capabilities.append(item);
-                    }
-
-                    for (auto it = endpoint->properties().begin(); it != endpoint->properties().end(); it++)
-                    {
-                        QJsonObject item = {{"type", it.value()->type()}, {"retrievable", true}, {"reportable", true}, {"parameters", QJsonObject::fromVariantMap(it.value()->parameters())}};
-
-                        if (it.value()->value().isValid())
-                            item.insert("state", it.value()->state());
-
-                        properties.append(item);
-                    }
-
-                    if (!capabilities.isEmpty() || !properties.isEmpty())
-                    {
-                        QString id = client->uniqueId().append('/').append(device->key()), name = device->name(), model = device->name();
-
-                        if (it.value()->id())
-                        {
-                            QString endpointName = endpoint->options().value("name").toString();
-                            id.append(QString("/%1").arg(it.value()->id()));
-                            name.append(QString(" %1").arg(!endpointName.isEmpty() ? endpointName : QString::number(it.value()->id())));
-                        }
-
-                        if (!device->description().isEmpty())
-                            model.append(QString(" (%1)").arg(device->description()));
-
-                        devices.append(QJsonObject {{"id", id}, {"name", name}, {"type", endpoint->type()}, {"capabilities", capabilities}, {"properties", properties}, {"device_info", QJsonObject{{"model", model}}}});
-                    }
-                }
-            }
+            http->sendResponse(request, 401);
+            return;
         }
 
-        json = {{"request_id", request.headers().value("X-Request-Id")}, {"payload", QJsonObject {{"user_id", user->name().constData()}, {"devices", devices}}}};
+        dispatch(request.url(), chat, name, requestId, body, request.timer(), request.encoding(), [this, http, request] (const QByteArray &data, Encoding encoding, const Producer &producer) { reply(http, request, data, encoding, producer); });
 
-        if (m_debug)
-            qDebug() << user->name() << "devices data" << QJsonDocument(json).toJson(QJsonDocument::Compact).constData();
-
-        m_http->sendResponse(request, 200, {{"Content-Type", "application/json"}}, QJsonDocument(json).toJson(QJsonDocument::Compact));
-        m_apiCount++;
         return;
     }
     else if (request.url() == "/api/v1.0/user/devices/query")
     {
-        const User &user = findUser(request.headers().value("Authorization"));
-        QJsonArray queries = QJsonDocument::fromJson(request.body().toUtf8()).object().value("devices").toArray(), devices;
-        QJsonObject json;
+        QString requestId = request.headers().value("X-Request-Id"), body = request.body();
+        QByteArray name;
+        qint64 chat;
 
         if (request.method() != "POST")
         {
-            m_http->sendResponse(request, 405);
+            http->sendResponse(request, 405);
             return;
         }
 
-        if (user.isNull())
+        if (!authorize(request.headers().value("Authorization"), chat, name))
         {
-            m_http->sendResponse(request, 401);
+            http->sendResponse(request, 401);
             return;
         }
 
-        for (auto it = queries.begin(); it != queries.end(); it++)
-        {
-            QJsonObject query = it->toObject();
-            QString id = query.value("id").toString();
-            QList <QString> list = id.split('/');
-            Client *client = user->clients().value(list.value(0));
-
-            if (client)
-            {
-                const Device &device = client->devices().value(QString("%1/%2").arg(list.value(1), list.value(2)));
-
-                if (device.isNull())
-                {
-                    devices.append(QJsonObject {{"id", id}, {"error_code", "DEVICE_NOT_FOUND"}});
-                    continue;
-                }
-
-                if (device->available())
-                {
-                    const Endpoint &endpoint = device->endpoints().value(static_cast <quint8> (list.value(3).toInt()));
-                    QJsonArray capabilities, properties;
-
-                    if (endpoint.isNull())
-                    {
-                        devices.append(QJsonObject {{"id", id}, {"error_code", "DEVICE_NOT_FOUND"}});
-                        continue;
-                    }
-
-                    for (int i = 0; i < endpoint->capabilities().count(); i++)
-                    {
-                        const Capability &capability = endpoint->capabilities().at(i);
-                        capabilities.append(QJsonObject {{"type", capability->type()}, {"state", capability->state()}});
-                    }
-
-                    for (auto it = endpoint->properties().begin(); it != endpoint->properties().end(); it++)
-                    {
-                        if (!it.value()->value().isValid())
-                            continue;
-
-                        properties.append(QJsonObject {{"type", it.value()->type()}, {"state", it.value()->state()}});
-                    }
-
-                    devices.append(QJsonObject {{"id", id}, {"capabilities", capabilities}, {"properties", properties}});
-                    continue;
-                }
-            }
-
-            devices.append(QJsonObject {{"id", id}, {"error_code", "DEVICE_UNREACHABLE"}});
-        }
-
-        json = {{"request_id", request.headers().value("X-Request-Id")}, {"payload", QJsonObject {{"devices", devices}}}};
+        dispatch(request.url(), chat, name, requestId, body, request.timer(), request.encoding(), [this, http, request] (const QByteArray &data, Encoding encoding, const Producer &producer) { reply(http, request, data, encoding, producer); });
 
-        if (m_debug)
-        {
-            qDebug() << user->name() << "query reqest:" << request.body().toUtf8().constData();
-            qDebug() << user->name() << "query reply:" << QJsonDocument(json).toJson(QJsonDocument::Compact).constData();
-        }
-
-        m_http->sendResponse(request, 200, {{"Content-Type", "application/json"}}, QJsonDocument(json).toJson(QJsonDocument::Compact));
-        m_apiCount++;
         return;
     }
     else if (request.url() == "/api/v1.0/user/devices/action")
     {
-        const User &user = findUser(request.headers().value("Authorization"));
-        QJsonArray actions = QJsonDocument::fromJson(request.body().toUtf8()).object().value("payload").toObject().value("devices").toArray(), devices;
-        QJsonObject json;
+        QString requestId = request.headers().value("X-Request-Id"), body = request.body();
+        QByteArray name;
+        qint64 chat;
 
         if (request.method() != "POST")
         {
-            m_http->sendResponse(request, 405);
+            http->sendResponse(request, 405);
             return;
         }
 
-        if (user.isNull())
+        if (!authorize(request.headers().value("Authorization"), chat, name))
         {
-            m_http->sendResponse(request, 401);
+            http->sendResponse(request, 401);
             return;
         }
 
-        for (auto it = actions.begin(); it != actions.end(); it++)
-        {
-            QJsonObject action = it->toObject();
-            QJsonArray capabilities = action.value("capabilities").toArray();
-            QString id = action.value("id").toString();
-            QList <QString> list = id.split('/');
-            Client *client = user->clients().value(list.value(0));
-            bool check = false;
-
-            if (client)
-            {
-                const Device &device = client->devices().value(QString("%1/%2").arg(list.value(1), list.value(2)));
+        dispatch(request.url(), chat, name, requestId, body, request.timer(), request.encoding(), [this, http, request] (const QByteArray &data, Encoding encoding, const Producer &producer) { reply(http, request, data, encoding, producer); });
 
-                if (device.isNull())
-                {
-                    devices.append(QJsonObject {{"id", action.value("id")}, {"action_result", QJsonObject {{"status", "ERROR"}, {"error_code", "DEVICE_NOT_FOUND"}}}});
-                    continue;
-                }
+        return;
+    }
 
-                if (device->available())
-                {
-                    const Endpoint &endpoint = device->endpoints().value(static_cast <quint8> (list.value(3).toInt()));
+    http->sendResponse(request, 404);
+}
 
-                    if (!endpoint.isNull())
-                    {
-                        for (auto it = capabilities.begin(); it != capabilities.end(); it++)
-                        {
-                            QJsonObject json = it->toObject(), state = json.value("state").toObject();
-                            QString type = json.value("type").toString(), instance = state.value("instance").toString();
-
-                            for (int i = 0; i < endpoint->capabilities().count(); i++)
-                            {
-                                const Capability &capability = endpoint->capabilities().at(i);
-
-                                if (capability->type() == type && capability->instances().contains(instance))
-                                {
-                                    client->publish(endpoint, capability->action(state));
-                                    check = true;
-                                    break;
-                                }
-                            }
-                        }
-                    }
+void Controller::clusterRequest(QTcpSocket *socket, const QJsonObject &json)
+{
+    QElapsedTimer timer;
+    QString url = json.value("url").toString();
 
-                    if (check)
-                    {
-                        devices.append(QJsonObject {{"id", action.value("id")}, {"action_result", QJsonObject {{"status", "DONE"}}}});
-                        continue;
-                    }
-                }
-            }
+    if (url != "/api/v1.0/user/devices" && url != "/api/v1.0/user/devices/query" && url != "/api/v1.0/user/devices/action")
+    {
+        socket->abort();
+        return;
+    }
 
-            devices.append(QJsonObject {{"id", action.value("id")}, {"action_result", QJsonObject {{"status", "ERROR"}, {"error_code", "DEVICE_UNREACHABLE"}}}});
-        }
+    timer.start();
+    dispatch(url, json.value("chat").toString().toLongLong(), json.value("name").toString().toUtf8(), json.value("requestId").toString(), json.value("body").toString(), timer, Encoding::Identity, [this, socket] (const QByteArray &data, Encoding, const Producer &) { m_cluster->reply(socket, data); }, false, false);
+}
 
-        json = {{"request_id", request.headers().value("X-Request-Id")}, {"payload", QJsonObject {{"devices", devices}}}};
+void Controller::upgradeRequested(void)
+{
+    QMap <QString, int> listeners;
+    QList <Handoff> clients;
 
-        if (m_debug)
-        {
-            qDebug() << user->name() << "action reqest:" << request.body().toUtf8().constData();
-            qDebug() << user->name() << "action reply:" << QJsonDocument(json).toJson(QJsonDocument::Compact).constData();
-        }
+    qDebug() << "New process requested connection handoff";
+
+    m_server->pauseAccepting();
+    listeners.insert("hub", static_cast <int> (m_server->socketDescriptor()));
+
+    if (m_http)
+        listeners.insert("http", m_http->descriptor());
+
+    if (m_admin)
+        listeners.insert("admin", m_admin->descriptor());
 
-        m_http->sendResponse(request, 200, {{"Content-Type", "application/json"}}, QJsonDocument(json).toJson(QJsonDocument::Compact));
-        m_apiCount++;
+    if (m_httpLocal && m_httpLocal->descriptor() >= 0)
+        listeners.insert("http-socket", m_httpLocal->descriptor());
+
+    if (m_adminLocal && m_adminLocal->descriptor() >= 0)
+        listeners.insert("admin-socket", m_adminLocal->descriptor());
+
+    if (m_cluster->enabled())
+        listeners.insert("cluster", m_cluster->descriptor());
+
+    for (int i = 0; i < m_workers.count(); i++)
+    {
+        Worker *worker = m_workers.at(i);
+        QMetaObject::invokeMethod(worker, [worker, &clients] () { clients.append(worker->handoff()); }, Qt::BlockingQueuedConnection);
+    }
+
+    if (m_upgrade->send(listeners, clients))
+        qDebug() << clients.count() << "hub connections handed off, exiting";
+    else
+        qWarning() << "Connection handoff failed, hubs will reconnect";
+
+    QCoreApplication::quit();
+}
+
+void Controller::levelChanged(Watchdog::Level level)
+{
+    if (level == Watchdog::Level::Pause)
+    {
+        qWarning() << "Event loop is overloaded, new hub connections paused";
+        m_server->pauseAccepting();
         return;
     }
 
-    m_http->sendResponse(request, 404);
+    m_server->resumeAccepting();
 }
 
 void Controller::newConnection(void)
 {
-    QTcpSocket *socket = m_server->nextPendingConnection();
+    Transport *transport = m_server->nextTransport();
     Client *client;
 
-    if (!socket)
+    if (!transport)
         return;
 
-    client = new Client(socket);
+    if (!m_accepted)
+    {
+        qDebug() << "First client connection accepted in" << m_startup.elapsed() << "ms";
+        m_accepted = true;
+    }
+
+    client = new Client(transport);
+    m_connectionGauge->add(1);
 
     if (m_debug)
         qDebug() << client << "connected";
 
     connect(client, &Client::disconnected, this, &Controller::disconnected);
     connect(client, &Client::tokenReceived, this, &Controller::tokenReceived);
-    connect(client, &Client::devicesUpdated, this, &Controller::devicesUpdated);
-    connect(client, &Client::dataUpdated, this, &Controller::dataUpdated);
 }
 
 void Controller::disconnected(void)
 {
     Client *client = reinterpret_cast <Client*> (sender());
-    UserObject *user = reinterpret_cast <UserObject*> (client->parent());
 
-    if (user)
-    {
-        bool check = false;
-
-        if (user->clients().value(client->uniqueId()) == client)
-        {
-            user->clients().remove(client->uniqueId());
-            check = true;
-        }
-
-        qDebug() << "Client" << QString("%1:%2").arg(user->name(), client->uniqueId()) << (check ? "disconnected:" : "stale connection closed:") << client->socketError();
-    }
+    if (m_debug)
+        qDebug() << client << "disconnected before authorization:" << client->socketError();
 
+    m_connectionGauge->add(-1);
     client->deleteLater();
 }
 
 void Controller::tokenReceived(const QByteArray &token)
 {
     Client *client = reinterpret_cast <Client*> (sender());
+    QPointer <Client> pointer = client;
+    QByteArray name;
+    Worker *target;
+    UserData *user;
+    qint64 chat;
 
-    for (auto it = m_users.begin(); it != m_users.end(); it++)
-    {
-        Client *other = it.value()->clients().value(client->uniqueId());
-        bool check = false;
-
-        if (it.value()->clientToken() != token)
-            continue;
-
-        if (other)
-        {
-            it.value()->clients().remove(client->uniqueId());
-            other->close();
-            other->deleteLater();
-            check = true;
-        }
-
-        qDebug() << "Client" << QString("%1:%2").arg(it.value()->name(), client->uniqueId()) << (check ? "replaced" : "authorized");
-        client->setParent(it.value().data());
-        it.value()->clients().insert(client->uniqueId(), client);
-        break;
-    }
-}
-
-void Controller::devicesUpdated(void)
-{
-    Client *client = reinterpret_cast <Client*> (sender());
-    UserObject *user = reinterpret_cast <UserObject*> (client->parent());
+    m_lock.lockForWrite();
+    user = findUser(Database::Lookup::ClientToken, QString(token.toHex()), [this, &token] () { return m_users.findByClientToken(token); });
 
     if (user)
     {
-        QJsonObject json = {{"ts", QDateTime::currentSecsSinceEpoch()}, {"payload", QJsonObject {{"user_id", user->name().constData()}}}};
-        system(QString("curl --http1.1 -m 5 -X POST -H 'Authorization: OAuth %1' -H 'Content-Type: application/json' -d '%2' -s https://dialogs.yandex.net/api/v1/skills/%3/callback/discovery > /dev/null &").arg(m_skillToken, QJsonDocument(json).toJson(QJsonDocument::Compact).constData(), m_skillId).toUtf8().constData());
-        m_eventCount++;
+        chat = user->chat;
+        name = m_users.name(user);
     }
-}
 
-void Controller::dataUpdated(const Device &device)
-{
-    Client *client = reinterpret_cast <Client*> (sender());
-    UserObject *user = reinterpret_cast <UserObject*> (client->parent());
-    QJsonObject json = {{"ts", QDateTime::currentSecsSinceEpoch()}};
-    QJsonArray devices;
+    m_lock.unlock();
 
     if (!user)
         return;
 
-    for (auto it = device->endpoints().begin(); it != device->endpoints().end(); it++)
-    {
-        const Endpoint &endpoint = it.value();
-        QString id = client->uniqueId().append('/').append(device->key());
-        QJsonArray capabilities, properties;
-
-        if (endpoint->id())
-            id.append(QString("/%1").arg(endpoint->id()));
-
-        for (int i = 0; i < endpoint->capabilities().count(); i++)
-        {
-            const Capability &capability = endpoint->capabilities().at(i);
-
-            if (!capability->updated())
-                continue;
+    target = worker(chat);
 
-            capabilities.append(QJsonObject {{"type", capability->type()}, {"state", capability->state()}});
-            capability->setUpdated(false);
-        }
+    client->authorize();
 
-        for (auto it = endpoint->properties().begin(); it != endpoint->properties().end(); it++)
-        {
-            if (!it.value()->updated())
-                continue;
-
-            properties.append(QJsonObject {{"type", it.value()->type()}, {"state", it.value()->state()}});
-            it.value()->setUpdated(false);
-
-            if (it.value()->instance() != "button" && it.value()->instance() != "vibration")
-                continue;
+    QMetaObject::invokeMethod(this, [this, pointer, chat, name, target] ()
+    {
+        Client *client = pointer.data();
 
-            it.value()->setValue(QVariant());
-        }
+        if (!client || !client->connected())
+            return;
 
-        if (capabilities.isEmpty() && properties.isEmpty())
-            continue;
+        client->disconnect(this);
+        client->moveToThread(target->thread());
 
-        devices.append(QJsonObject {{"id", id}, {"capabilities", capabilities}, {"properties", properties}});
-    }
+        target->post([chat, name, client] (Worker *worker) { worker->attach(chat, name, client); });
 
-    if (!devices.isEmpty())
-    {
-        json.insert("payload", QJsonObject {{"user_id", user->name().constData()}, {"devices", devices}});
-        system(QString("curl --http1.1 -m 5 -X POST -H 'Authorization: OAuth %1' -H 'Content-Type: application/json' -d '%2' -s https://dialogs.yandex.net/api/v1/skills/%3/callback/state > /dev/null &").arg(m_skillToken, QJsonDocument(json).toJson(QJsonDocument::Compact).constData(), m_skillId).toUtf8().constData());
-        m_eventCount++;
-    }
+    }, Qt::QueuedConnection);
 }
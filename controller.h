@@ -3,111 +3,118 @@
 
 #define CODE_EXPIRE_TIMEOUT     60
 #define TOKEN_EXPIRE_TIMEOUT    31536000    // one little year
-
-#include <QtSql>
-#include <QTcpServer>
+#define STREAM_THRESHOLD        1000
+#define STREAM_CHUNK_SIZE       (32 * 1024)
+#define LOOKUP_MISS_TIMEOUT     5000
+#define LOOKUP_MISS_LIMIT       65536
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QReadWriteLock>
+#include "assets.h"
+#include "cluster.h"
 #include "crypto.h"
+#include "database.h"
 #include "http.h"
 #include "client.h"
+#include "upgrade.h"
+#include "user.h"
+#include "watchdog.h"
+#include "worker.h"
+#include "yandex.h"
 
-class UserObject;
-typedef QSharedPointer <UserObject> User;
+typedef std::function <void (const QByteArray &data, Encoding encoding, const Producer &producer)> Response;
 
-enum class BotStatus
+struct Cursor
 {
-    Idle,
-    Remove,
-    Renew
+    QString client, device;
+    int index, count;
+    bool started, finished;
 };
 
-class UserObject : public QObject
+class Controller : public QObject
 {
     Q_OBJECT
 
 public:
 
-    UserObject(void) : m_botStatus(BotStatus::Idle) {}
-
-    inline QByteArray name(void) { return m_name; }
-    inline void setName(const QByteArray &value) { m_name = value; }
-
-    inline QByteArray hash(void) { return m_hash; }
-    inline void setHash(const QByteArray &value) { m_hash = value; }
-
-    inline QByteArray clientToken(void) { return m_clientToken; }
-    inline void setClientToken(const QByteArray &value) { m_clientToken = value; }
-
-    inline QByteArray accessToken(void) { return m_accessToken; }
-    inline void setAccessToken(const QByteArray &value) { m_accessToken = value; }
-
-    inline QByteArray refreshToken(void) { return m_refreshToken; }
-    inline void setRefreshToken(const QByteArray &value) { m_refreshToken = value; }
-
-    inline qint64 tokenExpire(void) { return m_tokenExpire; }
-    inline void setTokenExpire(const qint64 &value) { m_tokenExpire = value; }
-
-    inline qint64 codeExpire(void) { return m_codeExpire; }
-    inline void setCodeExpire(const qint64 &value) { m_codeExpire = value; }
-
-    inline BotStatus botStatus(void) { return m_botStatus; }
-    inline void setBotStatus(BotStatus value) { m_botStatus = value; }
-
-    inline QMap <QString, Client*> &clients(void) { return m_clients; }
+    Controller(const QString &configFile, QObject *parent = nullptr);
+    ~Controller(void);
 
 private:
 
-    QByteArray m_name, m_hash, m_clientToken, m_accessToken, m_refreshToken;
-    qint64 m_tokenExpire, m_codeExpire;
-    BotStatus m_botStatus;
+    QSettings *m_settings;
+    QTimer *m_statsTimer;
+    TransportServer *m_server;
+    HTTP *m_http, *m_admin, *m_httpLocal, *m_adminLocal;
+    Assets *m_assets;
+    Database *m_database;
+    Cluster *m_cluster;
+    Upgrade *m_upgrade;
+    Watchdog *m_watchdog;
+    AES128 *m_aes;
 
-    QMap <QString, Client*> m_clients;
+    QElapsedTimer m_startup;
+    bool m_loaded, m_accepted, m_debug;
+    QByteArray m_path, m_clientId, m_clientSecret, m_skillId, m_skillToken, m_botHost, m_botToken, m_botSecret, m_rrdPath;
+    quint64 m_apiCount, m_eventCount;
+    qint64 m_clientCount;
 
-};
+    Counter *m_apiCounter, *m_discoveryCounter, *m_stateCounter, *m_shedCounter;
+    Gauge *m_userGauge, *m_clientGauge, *m_connectionGauge, *m_queueGauge, *m_databaseGauge, *m_memoryGauge;
 
-class Controller : public QObject
-{
-    Q_OBJECT
+#ifdef RRD_SUPPORT
+    RRD *m_rrd;
+#endif
 
-public:
+    Users m_users;
+    QSet <qint64> m_removed;
+    QMap <QByteArray, qint64> m_codes;
+    QList <Worker*> m_workers;
+    QList <QThread*> m_httpThreads;
+    QReadWriteLock m_lock;
 
-    Controller(QObject *parent = nullptr);
-    ~Controller(void);
+    QHash <QString, qint64> m_misses;
+    QMutex m_missLock;
 
-private:
+    QByteArray randomData(int length);
+    qint64 residentMemory(void);
+    void storeTokens(UserData *user);
 
-    QSqlDatabase m_db;
+    Worker *worker(qint64 chat);
+    void reply(HTTP *http, Request request, const QByteArray &data, Encoding encoding, const Producer &producer);
 
-    QSettings *m_settings;
-    QTimer *m_codeTimer, *m_statsTimer;
-    QTcpServer *m_server;
-    HTTP *m_http;
-    AES128 *m_aes;
+    void loadUsers(bool wait);
+    void insertUser(const UserRecord &record);
+    void removeUser(qint64 chat);
+    void restoreClient(const Handoff &handoff);
 
-    bool m_debug;
-    QByteArray m_path, m_clientId, m_clientSecret, m_skillId, m_skillToken, m_botHost, m_botToken, m_botSecret, m_rrdPath;
-    quint32 m_apiCount, m_eventCount, m_clientCount, m_descriptorCount;
+    bool lookupUser(Database::Lookup lookup, const QVariant &value, UserRecord &record);
+    UserData *findUser(Database::Lookup lookup, const QVariant &value, const std::function <UserData *(void)> &find);
+    UserData *findUser(const QString &header);
+    bool authorize(const QString &header, qint64 &chat, QByteArray &name);
 
-    QMap <qint64, User> m_users;
-    QMap <QByteArray, User> m_codes;
+    void dispatch(const QString &url, qint64 chat, const QByteArray &name, const QString &requestId, const QString &body, const QElapsedTimer &timer, Encoding encoding, const Response &callback, bool forward = true, bool stream = true);
+    Producer producer(Worker *target, const QString &type, qint64 chat, const QByteArray &name, const QString &requestId, const QJsonArray &queries);
 
-    QByteArray randomData(int length);
-    void storeTokens(const User &user);
+    static QByteArray jsonString(const QString &value);
 
-    User findUser(const QByteArray &name);
-    User findUser(const QString &header);
+    void requestReceived(HTTP *http, Request &request);
+    void adminRequestReceived(HTTP *http, Request &request);
 
 private slots:
 
-    void clearCodes(void);
+    void usersAvailable(void);
+    void updateMetrics(void);
     void updateStats(void);
 
-    void requestReceived(Request &request);
+    void clusterRequest(QTcpSocket *socket, const QJsonObject &json);
+    void upgradeRequested(void);
+    void levelChanged(Watchdog::Level level);
     void newConnection(void);
 
     void disconnected(void);
     void tokenReceived(const QByteArray &token);
-    void devicesUpdated(void);
-    void dataUpdated(const Device &device);
 
 };
 
@@ -11,6 +11,9 @@ class AES128
 public:
 
     void init(const QByteArray &key, const QByteArray &iv);
+
+    inline QByteArray key(void) const { return QByteArray(reinterpret_cast <const char*> (m_roundKey), 16); }
+    inline QByteArray iv(void) const { return QByteArray(reinterpret_cast <const char*> (m_iv), sizeof(m_iv)); }
     void cbcEncrypt(QByteArray &buffer);
     void cbcDecrypt(QByteArray &buffer);
 
@@ -0,0 +1,265 @@
+#include <QDateTime>
+#include "database.h"
+
+Database::Database(const QString &file, int interval) : QObject(nullptr), m_thread(new QThread), m_timer(nullptr), m_file(file), m_interval(interval), m_finished(false)
+{
+    moveToThread(m_thread);
+    connect(m_thread, &QThread::started, this, &Database::open);
+    m_thread->start();
+}
+
+Database::~Database(void)
+{
+    QMetaObject::invokeMethod(this, [this] ()
+    {
+        commit();
+
+        m_insertQuery = QSqlQuery();
+        m_removeQuery = QSqlQuery();
+        m_tokensQuery = QSqlQuery();
+
+        m_db.close();
+
+    }, Qt::BlockingQueuedConnection);
+
+    m_thread->quit();
+    m_thread->wait();
+
+    delete m_thread;
+}
+
+bool Database::fetchUsers(QList <UserRecord> &list, bool wait)
+{
+    QMutexLocker lock(&m_mutex);
+
+    if (wait && m_users.isEmpty() && !m_finished)
+        m_condition.wait(&m_mutex);
+
+    list.append(m_users);
+    m_users.clear();
+
+    return !m_finished;
+}
+
+bool Database::findUser(Lookup lookup, const QVariant &value, UserRecord &record)
+{
+    static const QList <QString> columns = {"chat", "name", "clientToken", "accessToken", "refreshToken"};
+    QString connection = QString("lookup-%1").arg(reinterpret_cast <quintptr> (QThread::currentThread()));
+    QSqlDatabase db = QSqlDatabase::contains(connection) ? QSqlDatabase::database(connection, false) : QSqlDatabase::addDatabase("QSQLITE", connection);
+    QSqlQuery query;
+
+    if (value.toString().isEmpty())
+        return false;
+
+    if (!db.isOpen())
+    {
+        db.setDatabaseName(m_file);
+        db.setConnectOptions("QSQLITE_OPEN_READONLY");
+
+        if (!db.open())
+        {
+            qWarning() << "Database lookup open error" << db.lastError().text();
+            return false;
+        }
+    }
+
+    query = QSqlQuery(db);
+    query.prepare(QString("SELECT chat, name, hash, clientToken, accessToken, refreshToken, tokenExpire FROM users WHERE %1 = :value LIMIT 1").arg(columns.at(static_cast <int> (lookup))));
+    query.bindValue(":value", value);
+
+    if (!query.exec())
+    {
+        qWarning() << "Database lookup error" << query.lastError().text();
+        return false;
+    }
+
+    if (!query.next())
+        return false;
+
+    record = {query.value(0).toLongLong(), query.value(1).toByteArray(), query.value(2).toByteArray(), QByteArray::fromHex(query.value(3).toByteArray()), QByteArray::fromHex(query.value(4).toByteArray()), QByteArray::fromHex(query.value(5).toByteArray()), query.value(6).toLongLong()};
+    return true;
+}
+
+int Database::pending(void)
+{
+    QMutexLocker lock(&m_mutex);
+    return m_operations.count() + m_tokens.count();
+}
+
+void Database::insertUser(qint64 chat, const QByteArray &name, const QByteArray &hash, const QByteArray &clientToken)
+{
+    QMutexLocker lock(&m_mutex);
+    m_operations.append({Action::Insert, chat, name, hash, clientToken, QDateTime::currentSecsSinceEpoch()});
+}
+
+void Database::removeUser(qint64 chat)
+{
+    QMutexLocker lock(&m_mutex);
+    m_operations.append({Action::Remove, chat, QByteArray(), QByteArray(), QByteArray(), 0});
+}
+
+void Database::storeTokens(const QByteArray &name, const QByteArray &accessToken, const QByteArray &refreshToken, qint64 tokenExpire)
+{
+    QMutexLocker lock(&m_mutex);
+    m_tokens.insert(name, {accessToken, refreshToken, tokenExpire, QDateTime::currentSecsSinceEpoch()});
+}
+
+void Database::open(void)
+{
+    m_db = QSqlDatabase::addDatabase("QSQLITE", "writer");
+    m_db.setDatabaseName(m_file);
+
+    if (!m_db.open())
+    {
+        qWarning() << "Database open error" << m_db.lastError().text();
+        m_mutex.lock();
+        m_finished = true;
+        m_condition.wakeAll();
+        m_mutex.unlock();
+        emit usersAvailable();
+        return;
+    }
+
+    QSqlQuery(m_db).exec("PRAGMA journal_mode = WAL");
+    QSqlQuery(m_db).exec("PRAGMA synchronous = NORMAL");
+    QSqlQuery(m_db).exec("CREATE INDEX IF NOT EXISTS users_name ON users (name)");
+    QSqlQuery(m_db).exec("CREATE INDEX IF NOT EXISTS users_clientToken ON users (clientToken)");
+    QSqlQuery(m_db).exec("CREATE INDEX IF NOT EXISTS users_accessToken ON users (accessToken)");
+    QSqlQuery(m_db).exec("CREATE INDEX IF NOT EXISTS users_refreshToken ON users (refreshToken)");
+
+    m_insertQuery = QSqlQuery(m_db);
+    m_insertQuery.prepare("INSERT INTO users (chat, name, hash, clientToken, timestamp) VALUES (:chat, :name, :hash, :clientToken, :timestamp) ON CONFLICT (chat) DO UPDATE SET name = excluded.name, hash = excluded.hash, clientToken = excluded.clientToken, accessToken = NULL, refreshToken = NULL, tokenExpire = NULL, timestamp = excluded.timestamp");
+
+    m_removeQuery = QSqlQuery(m_db);
+    m_removeQuery.prepare("DELETE FROM users WHERE chat = :chat");
+
+    m_tokensQuery = QSqlQuery(m_db);
+    m_tokensQuery.prepare("UPDATE users SET accessToken = :accessToken, refreshToken = :refreshToken, tokenExpire = :tokenExpire, timestamp = :timestamp WHERE name = :name");
+
+    m_timer = new QTimer(this);
+    connect(m_timer, &QTimer::timeout, this, &Database::commit);
+    m_timer->start(m_interval);
+
+    load();
+}
+
+void Database::load(void)
+{
+    QSqlQuery query(m_db);
+    QList <UserRecord> list;
+    bool check = true;
+
+    query.setForwardOnly(true);
+
+    if (!query.exec("SELECT chat, name, hash, clientToken, accessToken, refreshToken, tokenExpire FROM users"))
+        qWarning() << "Database users load error" << query.lastError().text();
+
+    while (check)
+    {
+        check = query.next();
+
+        if (check)
+        {
+            list.append({query.value(0).toLongLong(), query.value(1).toByteArray(), query.value(2).toByteArray(), QByteArray::fromHex(query.value(3).toByteArray()), QByteArray::fromHex(query.value(4).toByteArray()), QByteArray::fromHex(query.value(5).toByteArray()), query.value(6).toLongLong()});
+
+            if (list.count() < DATABASE_LOAD_BATCH)
+                continue;
+        }
+
+        m_mutex.lock();
+        m_users.append(list);
+        m_finished = !check;
+        m_condition.wakeAll();
+        m_mutex.unlock();
+
+        list.clear();
+        emit usersAvailable();
+    }
+}
+
+void Database::commit(void)
+{
+    QList <Operation> operations;
+    QMap <QByteArray, Tokens> tokens;
+
+    m_mutex.lock();
+    operations.swap(m_operations);
+    tokens.swap(m_tokens);
+    m_mutex.unlock();
+
+    if (operations.isEmpty() && tokens.isEmpty())
+        return;
+
+    if (!m_db.isOpen() || !m_db.transaction())
+    {
+        qWarning() << "Database transaction error" << m_db.lastError().text();
+        restore(operations, tokens);
+        return;
+    }
+
+    for (int i = 0; i < operations.count(); i++)
+    {
+        const Operation &operation = operations.at(i);
+
+        switch (operation.action)
+        {
+            case Action::Insert:
+
+                m_insertQuery.bindValue(":chat", operation.chat);
+                m_insertQuery.bindValue(":name", QString(operation.name));
+                m_insertQuery.bindValue(":hash", QString(operation.hash));
+                m_insertQuery.bindValue(":clientToken", QString(operation.clientToken.toHex()));
+                m_insertQuery.bindValue(":timestamp", operation.timestamp);
+
+                if (!m_insertQuery.exec())
+                    qWarning() << "Database insert error" << m_insertQuery.lastError().text();
+
+                break;
+
+            case Action::Remove:
+
+                m_removeQuery.bindValue(":chat", operation.chat);
+
+                if (!m_removeQuery.exec())
+                    qWarning() << "Database remove error" << m_removeQuery.lastError().text();
+
+                break;
+        }
+    }
+
+    for (auto it = tokens.begin(); it != tokens.end(); it++)
+    {
+        m_tokensQuery.bindValue(":accessToken", QString(it.value().accessToken.toHex()));
+        m_tokensQuery.bindValue(":refreshToken", QString(it.value().refreshToken.toHex()));
+        m_tokensQuery.bindValue(":tokenExpire", it.value().tokenExpire);
+        m_tokensQuery.bindValue(":timestamp", it.value().timestamp);
+        m_tokensQuery.bindValue(":name", QString(it.key()));
+
+        if (!m_tokensQuery.exec())
+            qWarning() << "Database tokens update error" << m_tokensQuery.lastError().text();
+    }
+
+    if (!m_db.commit())
+    {
+        qWarning() << "Database commit error" << m_db.lastError().text();
+        m_db.rollback();
+        restore(operations, tokens);
+    }
+}
+
+void Database::restore(const QList <Operation> &operations, const QMap <QByteArray, Tokens> &tokens)
+{
+    int count;
+
+    m_mutex.lock();
+    m_operations = operations + m_operations;
+
+    for (auto it = tokens.begin(); it != tokens.end(); it++)
+        if (!m_tokens.contains(it.key()))
+            m_tokens.insert(it.key(), it.value());
+
+    count = m_operations.count() + m_tokens.count();
+    m_mutex.unlock();
+
+    qWarning() << "Database commit postponed," << count << "operations pending";
+}
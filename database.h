@@ -0,0 +1,99 @@
+#ifndef DATABASE_H
+#define DATABASE_H
+
+#define DATABASE_COMMIT_INTERVAL    1000
+#define DATABASE_LOAD_BATCH         10000
+
+#include <QMutex>
+#include <QThread>
+#include <QTimer>
+#include <QWaitCondition>
+#include <QtSql>
+
+struct UserRecord
+{
+    qint64 chat;
+    QByteArray name, hash, clientToken, accessToken, refreshToken;
+    qint64 tokenExpire;
+};
+
+class Database : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    enum class Lookup
+    {
+        Chat,
+        Name,
+        ClientToken,
+        AccessToken,
+        RefreshToken
+    };
+
+    Database(const QString &file, int interval);
+    ~Database(void);
+
+    bool fetchUsers(QList <UserRecord> &list, bool wait);
+    bool findUser(Lookup lookup, const QVariant &value, UserRecord &record);
+    int pending(void);
+
+    void insertUser(qint64 chat, const QByteArray &name, const QByteArray &hash, const QByteArray &clientToken);
+    void removeUser(qint64 chat);
+    void storeTokens(const QByteArray &name, const QByteArray &accessToken, const QByteArray &refreshToken, qint64 tokenExpire);
+
+private:
+
+    enum class Action
+    {
+        Insert,
+        Remove
+    };
+
+    struct Operation
+    {
+        Action action;
+        qint64 chat;
+        QByteArray name, hash, clientToken;
+        qint64 timestamp;
+    };
+
+    struct Tokens
+    {
+        QByteArray accessToken, refreshToken;
+        qint64 tokenExpire, timestamp;
+    };
+
+    QThread *m_thread;
+    QTimer *m_timer;
+
+    QSqlDatabase m_db;
+    QSqlQuery m_insertQuery, m_removeQuery, m_tokensQuery;
+
+    QString m_file;
+    int m_interval;
+
+    QMutex m_mutex;
+    QList <Operation> m_operations;
+    QMap <QByteArray, Tokens> m_tokens;
+
+    QWaitCondition m_condition;
+    QList <UserRecord> m_users;
+    bool m_finished;
+
+    void load(void);
+    void restore(const QList <Operation> &operations, const QMap <QByteArray, Tokens> &tokens);
+
+private slots:
+
+    void open(void);
+    void commit(void);
+
+signals:
+
+    void usersAvailable(void);
+
+};
+
+#endif
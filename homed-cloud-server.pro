@@ -3,19 +3,52 @@ QT = core network sql
 CONFIG += c++17 console debug
 
 SOURCES += \
+        assets.cpp \
         capability.cpp \
         client.cpp \
+        cluster.cpp \
+        compress.cpp \
         controller.cpp \
         crypto.cpp \
+        database.cpp \
         http.cpp \
-        main.cpp
+        main.cpp \
+        metrics.cpp \
+        tls.cpp \
+        transport.cpp \
+        upgrade.cpp \
+        user.cpp \
+        watchdog.cpp \
+        wheel.cpp \
+        worker.cpp \
+        yandex.cpp
 
 HEADERS += \
+    assets.h \
     capability.h \
     client.h \
+    cluster.h \
+    compress.h \
     controller.h \
     crypto.h \
-    http.h
+    database.h \
+    http.h \
+    metrics.h \
+    tls.h \
+    transport.h \
+    upgrade.h \
+    user.h \
+    watchdog.h \
+    wheel.h \
+    worker.h \
+    yandex.h
+
+LIBS += -lz
+
+rrd {
+    DEFINES += RRD_SUPPORT
+    LIBS += -lrrd
+}
 
 target.path = /home/u236
 INSTALLS += target
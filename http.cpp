@@ -1,63 +1,446 @@
-#include <QTimer>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <QMutex>
+#include <QThread>
 #include <QUrl>
 #include "http.h"
 
-HTTP::HTTP(QSettings *settings, QObject *parent) : QObject(parent), m_server(new QTcpServer(this))
+static QMutex addressMutex;
+static QHash <QHostAddress, int> addressCount;
+
+static Counter *rejectedHeader = Metrics::instance()->counter("http_rejected_total", "reason=\"header\"");
+static Counter *rejectedBody = Metrics::instance()->counter("http_rejected_total", "reason=\"body\"");
+static Counter *rejectedAddress = Metrics::instance()->counter("http_rejected_total", "reason=\"address\"");
+static Counter *rejectedMemory = Metrics::instance()->counter("http_rejected_total", "reason=\"memory\"");
+static Counter *rejectedTimeout = Metrics::instance()->counter("http_rejected_total", "reason=\"timeout\"");
+
+Stream::Stream(QIODevice *socket, Encoding encoding, const Producer &producer, QObject *parent) : QObject(parent), m_socket(socket), m_compressor(encoding != Encoding::Identity ? new Compressor(encoding) : nullptr), m_producer(producer), m_pending(false)
+{
+    connect(socket, &QIODevice::bytesWritten, this, &Stream::next);
+    connect(socket, &QIODevice::destroyed, this, &Stream::deleteLater);
+    next();
+}
+
+Stream::~Stream(void)
+{
+    delete m_compressor;
+}
+
+void Stream::receive(const QByteArray &data)
+{
+    QByteArray buffer = m_compressor ? m_compressor->write(data, data.isEmpty()) : data;
+
+    m_pending = false;
+
+    if (!m_socket)
+    {
+        deleteLater();
+        return;
+    }
+
+    if (!buffer.isEmpty())
+        m_socket->write(QByteArray::number(buffer.length(), 16).append("\r\n").append(buffer).append("\r\n"));
+
+    if (data.isEmpty())
+    {
+        m_socket->write("0\r\n\r\n");
+        m_socket->close();
+        deleteLater();
+        return;
+    }
+
+    next();
+}
+
+void Stream::next(void)
+{
+    QObject *context = parent();
+    QPointer <Stream> pointer = this;
+
+    if (m_pending || !m_socket || m_socket->bytesToWrite() >= HTTP_STREAM_WATERMARK)
+        return;
+
+    m_pending = true;
+    m_producer([context, pointer] (const QByteArray &data) { QMetaObject::invokeMethod(context, [pointer, data] () { if (pointer) pointer->receive(data); }); });
+}
+
+HTTP::HTTP(quint16 port, bool reusePort, QObject *parent, int descriptor) : QObject(parent), m_server(new TlsServer(this)), m_notifier(nullptr), m_connections(Metrics::instance()->gauge("http_connections")), m_memory(Metrics::instance()->gauge("http_inflight_bytes")), m_addressLimit(HTTP_ADDRESS_LIMIT)
 {
     connect(m_server, &QTcpServer::newConnection, this, &HTTP::newConnection);
 
-    if (!m_server->listen(QHostAddress::Any, static_cast <quint16> (settings->value("http/port", 8084).toInt())))
+    if (!(descriptor >= 0 ? m_server->setSocketDescriptor(descriptor) : reusePort ? listenShared(port) : m_server->listen(QHostAddress::Any, port)))
     {
         qWarning() << "HTTP server startup error:" << m_server->errorString();
         return;
     }
 
-    qDebug() << "HTTP server listening on port" << m_server->serverPort();
+    qDebug() << "HTTP server listening on port" << m_server->serverPort() << (reusePort ? QString("in thread %1").arg(QThread::currentThread()->objectName()) : QString());
+}
+
+HTTP::HTTP(const QString &path, QObject *parent, int descriptor) : QObject(parent), m_server(nullptr), m_notifier(nullptr), m_connections(Metrics::instance()->gauge("http_connections")), m_memory(Metrics::instance()->gauge("http_inflight_bytes")), m_addressLimit(0)
+{
+    if (descriptor >= 0)
+        m_notifier = new QSocketNotifier(descriptor, QSocketNotifier::Read, this);
+    else if (!listenLocal(path))
+        return;
+
+    connect(m_notifier, &QSocketNotifier::activated, this, &HTTP::newLocalConnection);
+    qDebug() << "HTTP server listening on socket" << path;
+}
+
+HTTP::~HTTP(void)
+{
+    if (!m_notifier)
+        return;
+
+    ::close(static_cast <int> (m_notifier->socket()));
 }
 
 void HTTP::sendResponse(Request &request, quint16 code, const QMap <QString, QString> &headers, const QByteArray &response)
 {
-    QByteArray buffer;
+    QByteArray buffer, data;
 
-    switch (code)
+    if (request.encoding() != Encoding::Identity && response.length() >= COMPRESSION_THRESHOLD && !headers.contains("Content-Encoding"))
+        data = Compressed::encode(request.encoding(), response);
+
+    for (auto it = headers.begin(); it != headers.end(); it++)
+        buffer.append(QString("\r\n%1: %2").arg(it.key(), it.value()).toUtf8());
+
+    if (data.isEmpty())
     {
-        case 200: buffer = "HTTP/1.1 200 OK"; break;
-        case 301: buffer = "HTTP/1.1 301 Moved Permanently"; break;
-        case 401: buffer = "HTTP/1.1 401 Unauthorized"; break;
-        case 403: buffer = "HTTP/1.1 403 Forbidden"; break;
-        case 404: buffer = "HTTP/1.1 404 Not Found"; break;
-        case 405: buffer = "HTTP/1.1 405 Method Not Allowed"; break;
+        sendResponse(request, code, buffer, response);
+        return;
     }
 
+    buffer.append(QString("\r\nContent-Encoding: %1\r\nVary: Accept-Encoding").arg(Compressed::name(request.encoding())).toUtf8());
+    sendResponse(request, code, buffer, data);
+}
+
+void HTTP::sendResponse(Request &request, quint16 code, const QByteArray &headers, const QByteArray &response)
+{
+    if (QThread::currentThread() != thread())
+    {
+        QMetaObject::invokeMethod(this, [this, request, code, headers, response] () mutable { sendResponse(request, code, headers, response); }, Qt::QueuedConnection);
+        return;
+    }
+
+    if (!request.socket())
+        return;
+
+    request.socket()->write(status(code).append(headers).append("\r\n\r\n"));
+    request.socket()->write(response);
+    request.socket()->close();
+
+    observe(request, code);
+}
+
+void HTTP::sendStream(Request &request, quint16 code, const QMap <QString, QString> &headers, const Producer &producer)
+{
+    QByteArray buffer = status(code);
+
+    if (QThread::currentThread() != thread())
+    {
+        QMetaObject::invokeMethod(this, [this, request, code, headers, producer] () mutable { sendStream(request, code, headers, producer); }, Qt::QueuedConnection);
+        return;
+    }
+
+    if (!request.socket())
+        return;
+
     for (auto it = headers.begin(); it != headers.end(); it++)
         buffer.append(QString("\r\n%1: %2").arg(it.key(), it.value()).toUtf8());
 
-    request.socket()->write(buffer.append("\r\n\r\n").append(response));
-    request.socket()->close();
+    if (request.encoding() != Encoding::Identity)
+        buffer.append(QString("\r\nContent-Encoding: %1\r\nVary: Accept-Encoding").arg(Compressed::name(request.encoding())).toUtf8());
+
+    if (m_pending.contains(request.socket()))
+    {
+        QIODevice *socket = request.socket();
+
+        setDeadline(m_pending[socket], HTTP_STREAM_TIMEOUT);
+        connect(socket, &QIODevice::bytesWritten, this, [this, socket] () { if (m_pending.contains(socket)) setDeadline(m_pending[socket], HTTP_STREAM_TIMEOUT); });
+    }
+
+    request.socket()->write(buffer.append("\r\nTransfer-Encoding: chunked\r\n\r\n"));
+    new Stream(request.socket(), request.encoding(), producer, this);
+
+    observe(request, code);
+}
+
+QByteArray HTTP::status(quint16 code)
+{
+    switch (code)
+    {
+        case 200: return "HTTP/1.1 200 OK";
+        case 301: return "HTTP/1.1 301 Moved Permanently";
+        case 304: return "HTTP/1.1 304 Not Modified";
+        case 401: return "HTTP/1.1 401 Unauthorized";
+        case 403: return "HTTP/1.1 403 Forbidden";
+        case 404: return "HTTP/1.1 404 Not Found";
+        case 405: return "HTTP/1.1 405 Method Not Allowed";
+        case 503: return "HTTP/1.1 503 Service Unavailable";
+    }
+
+    return QByteArray();
+}
+
+void HTTP::observe(Request &request, quint16 code)
+{
+    QString route = code != 404 ? request.url() : "unknown", key = QString("%1 %2").arg(route).arg(code);
+    Counter *counter = m_requests.value(key);
+    Histogram *histogram = m_durations.value(route);
+
+    if (!counter)
+    {
+        counter = Metrics::instance()->counter("http_requests_total", QString("route=\"%1\",code=\"%2\"").arg(route).arg(code));
+        m_requests.insert(key, counter);
+    }
+
+    if (!histogram)
+    {
+        histogram = Metrics::instance()->histogram("http_request_duration_seconds", QString("route=\"%1\"").arg(route));
+        m_durations.insert(route, histogram);
+    }
+
+    counter->increment();
+    histogram->observe(request.elapsed());
+}
+
+bool HTTP::listenShared(quint16 port)
+{
+    int descriptor = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0), enable = 1, disable = 0;
+    sockaddr_in6 address;
+
+    if (descriptor < 0)
+        return false;
+
+    memset(&address, 0, sizeof(address));
+    address.sin6_family = AF_INET6;
+    address.sin6_port = htons(port);
+    address.sin6_addr = in6addr_any;
+
+    setsockopt(descriptor, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    setsockopt(descriptor, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable));
+    setsockopt(descriptor, IPPROTO_IPV6, IPV6_V6ONLY, &disable, sizeof(disable));
+
+    if (bind(descriptor, reinterpret_cast <sockaddr*> (&address), sizeof(address)) < 0 || ::listen(descriptor, SOMAXCONN) < 0 || !m_server->setSocketDescriptor(descriptor))
+    {
+        qWarning() << "HTTP shared listener error:" << strerror(errno);
+        ::close(descriptor);
+        return false;
+    }
+
+    return true;
+}
+
+bool HTTP::listenLocal(const QString &path)
+{
+    int descriptor = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    QByteArray name = path.toLocal8Bit();
+    sockaddr_un address;
+
+    if (descriptor < 0)
+        return false;
+
+    if (static_cast <size_t> (name.length()) >= sizeof(address.sun_path))
+    {
+        qWarning() << "HTTP socket path" << path << "is too long";
+        ::close(descriptor);
+        return false;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, name.constData(), static_cast <size_t> (name.length()));
+    unlink(name.constData());
+
+    if (bind(descriptor, reinterpret_cast <sockaddr*> (&address), sizeof(address)) < 0 || chmod(name.constData(), 0666) < 0 || ::listen(descriptor, SOMAXCONN) < 0)
+    {
+        qWarning() << "HTTP socket" << path << "startup error:" << strerror(errno);
+        ::close(descriptor);
+        return false;
+    }
+
+    m_notifier = new QSocketNotifier(descriptor, QSocketNotifier::Read, this);
+    return true;
+}
+
+void HTTP::addConnection(QIODevice *socket, const TimerWheel::Callback &abort, const QHostAddress &address)
+{
+    Connection &connection = m_pending[socket];
+
+    connection.address = address;
+    connection.abort = abort;
+    connection.deadline = 0;
+    connection.length = -1;
+    connection.complete = false;
+
+    setDeadline(connection, HTTP_HEADER_TIMEOUT);
+
+    connect(socket, &QIODevice::readyRead, this, &HTTP::readyRead);
+    connect(socket, &QIODevice::destroyed, this, [this, socket] ()
+    {
+        Connection connection = m_pending.take(socket);
+
+        TimerWheel::instance()->cancel(connection.deadline);
+        m_memory->add(-connection.buffer.length());
+        m_connections->add(-1);
+
+        if (connection.address.isNull())
+            return;
+
+        addressMutex.lock();
+
+        if (--addressCount[connection.address] <= 0)
+            addressCount.remove(connection.address);
+
+        addressMutex.unlock();
+    });
+
+    m_connections->add(1);
+}
+
+void HTTP::setDeadline(Connection &connection, int timeout)
+{
+    TimerWheel::Callback abort = connection.abort;
+
+    TimerWheel::instance()->cancel(connection.deadline);
+    connection.deadline = TimerWheel::instance()->add(timeout, [abort] () { rejectedTimeout->increment(); abort(); });
+}
+
+void HTTP::reject(Connection &connection, Counter *counter)
+{
+    TimerWheel::Callback abort = connection.abort;
+
+    counter->increment();
+    abort();
 }
 
 void HTTP::newConnection(void)
 {
     QTcpSocket *socket = m_server->nextPendingConnection();
-    QTimer *timer;
+    QHostAddress address;
 
     if (!socket)
         return;
 
-    timer = new QTimer(socket);
-
-    connect(socket, &QTcpSocket::readyRead, this, &HTTP::readyRead);
     connect(socket, &QTcpSocket::disconnected, socket, &QTcpSocket::deleteLater);
-    connect(timer, &QTimer::timeout, socket, &QTcpSocket::abort);
 
-    timer->setSingleShot(true);
-    timer->start(HTTP_REQUEST_TIMEOUT);
+    if (m_addressLimit && !socket->peerAddress().isLoopback())
+    {
+        QMutexLocker locker(&addressMutex);
+        int &count = addressCount[socket->peerAddress()];
+
+        if (count >= m_addressLimit)
+        {
+            locker.unlock();
+            rejectedAddress->increment();
+            socket->abort();
+            socket->deleteLater();
+            return;
+        }
+
+        address = socket->peerAddress();
+        count++;
+    }
+
+    addConnection(socket, [socket] () { socket->abort(); }, address);
+}
+
+void HTTP::newLocalConnection(void)
+{
+    int descriptor;
+
+    while ((descriptor = accept4(static_cast <int> (m_notifier->socket()), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        QLocalSocket *socket = new QLocalSocket(this);
+
+        if (!socket->setSocketDescriptor(descriptor))
+        {
+            ::close(descriptor);
+            delete socket;
+            continue;
+        }
+
+        connect(socket, &QLocalSocket::disconnected, socket, &QLocalSocket::deleteLater);
+        addConnection(socket, [socket] () { socket->abort(); });
+    }
 }
 
 void HTTP::readyRead(void)
 {
-    QTcpSocket *socket = reinterpret_cast <QTcpSocket*> (sender());
-    QList <QString> list = QString(socket->readAll()).split("\r\n\r\n"), head = list.value(0).split("\r\n"), target = head.value(0).split(0x20), items;
+    QIODevice *socket = reinterpret_cast <QIODevice*> (sender());
+    QByteArray data = socket->readAll();
+    Connection *connection;
+
+    if (!m_pending.contains(socket))
+        return;
+
+    connection = &m_pending[socket];
+
+    if (connection->complete)
+        return;
+
+    if (m_memory->value() + data.length() > HTTP_MEMORY_LIMIT)
+    {
+        reject(*connection, rejectedMemory);
+        return;
+    }
+
+    connection->buffer.append(data);
+    m_memory->add(data.length());
+
+    if (connection->length < 0)
+    {
+        int position = connection->buffer.indexOf("\r\n\r\n");
+        qint64 length = 0;
+
+        if (position < 0 ? connection->buffer.length() > HTTP_HEADER_LIMIT : position > HTTP_HEADER_LIMIT)
+        {
+            reject(*connection, rejectedHeader);
+            return;
+        }
+
+        if (position < 0)
+            return;
+
+        for (int start = connection->buffer.indexOf("\r\n") + 2; start > 1 && start < position; start = connection->buffer.indexOf("\r\n", start) + 2)
+        {
+            if (qstrnicmp(connection->buffer.constData() + start, "Content-Length:", 15))
+                continue;
+
+            length = connection->buffer.mid(start + 15, connection->buffer.indexOf("\r\n", start) - start - 15).trimmed().toLongLong();
+            break;
+        }
+
+        if (length < 0 || length > HTTP_BODY_LIMIT)
+        {
+            reject(*connection, rejectedBody);
+            return;
+        }
+
+        connection->length = position + 4 + length;
+        setDeadline(*connection, HTTP_BODY_TIMEOUT);
+    }
+
+    if (connection->buffer.length() < connection->length)
+        return;
+
+    data = connection->buffer;
+    connection->complete = true;
+    connection->buffer.clear();
+    m_memory->add(-data.length());
+    setDeadline(*connection, HTTP_REQUEST_TIMEOUT);
+
+    parse(socket, data);
+}
+
+void HTTP::parse(QIODevice *socket, const QByteArray &data)
+{
+    QList <QString> list = QString(data).split("\r\n\r\n"), head = list.value(0).split("\r\n"), target = head.value(0).split(0x20), items;
     QString method = target.value(0), url = target.value(1), body = list.value(1);
     Request request(socket);
 
@@ -71,7 +454,12 @@ void HTTP::readyRead(void)
     for (int i = 1; i < head.length(); i++)
     {
         QList <QString> header = head.at(i).split(':');
-        request.headers().insert(header.value(0).trimmed(), header.value(1).trimmed());
+        QString name = header.value(0).trimmed();
+
+        if (!name.compare("Accept-Encoding", Qt::CaseInsensitive))
+            request.setEncoding(Compressed::negotiate(header.value(1)));
+
+        request.headers().insert(name, header.value(1).trimmed());
     }
 
     for (int i = 0; i < items.length(); i++)
@@ -1,20 +1,38 @@
 #ifndef HTTP_H
 #define HTTP_H
 
+#define HTTP_HEADER_TIMEOUT     2000
+#define HTTP_BODY_TIMEOUT       5000
 #define HTTP_REQUEST_TIMEOUT    5000
-
-#include <QSettings>
+#define HTTP_STREAM_WATERMARK   (64 * 1024)
+#define HTTP_STREAM_TIMEOUT     10000
+#define HTTP_HEADER_LIMIT       (8 * 1024)
+#define HTTP_BODY_LIMIT         (256 * 1024)
+#define HTTP_MEMORY_LIMIT       (64 * 1024 * 1024)
+#define HTTP_ADDRESS_LIMIT      32
+
+#include <functional>
+#include <QElapsedTimer>
+#include <QLocalSocket>
+#include <QPointer>
+#include <QSocketNotifier>
 #include <QTcpServer>
 #include <QTcpSocket>
+#include "compress.h"
+#include "metrics.h"
+#include "tls.h"
+#include "wheel.h"
 
 class Request
 {
 
 public:
 
-    Request(QTcpSocket *socket) : m_socket(socket) {}
+    Request(QIODevice *socket) : m_socket(socket), m_encoding(Encoding::Identity) { m_timer.start(); }
 
-    inline QTcpSocket *socket(void) { return m_socket; }
+    inline QIODevice *socket(void) { return m_socket; }
+    inline QElapsedTimer timer(void) { return m_timer; }
+    inline qint64 elapsed(void) { return m_timer.nsecsElapsed() / 1000; }
 
     inline QString method(void) { return m_method; }
     inline void setMethod(const QString &value) { m_method = value; }
@@ -25,33 +43,105 @@ public:
     inline QString body(void) { return m_body; }
     inline void setBody(const QString &value) { m_body = value; }
 
+    inline Encoding encoding(void) { return m_encoding; }
+    inline void setEncoding(Encoding value) { m_encoding = value; }
+
     inline QMap <QString, QString> &headers(void) { return m_headers; }
     inline QMap <QString, QString> &data(void) { return m_data; }
 
 private:
 
-    QTcpSocket *m_socket;
+    QPointer <QIODevice> m_socket;
+    QElapsedTimer m_timer;
     QString m_method, m_url, m_body;
+    Encoding m_encoding;
     QMap <QString, QString> m_headers, m_data;
 
 };
 
+typedef std::function <void (const QByteArray &data)> Chunk;
+typedef std::function <void (const Chunk &chunk)> Producer;
+
+class Stream : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    Stream(QIODevice *socket, Encoding encoding, const Producer &producer, QObject *parent);
+    ~Stream(void);
+
+private:
+
+    QPointer <QIODevice> m_socket;
+    Compressor *m_compressor;
+    Producer m_producer;
+    bool m_pending;
+
+    void receive(const QByteArray &data);
+
+private slots:
+
+    void next(void);
+
+};
+
 class HTTP : public QObject
 {
     Q_OBJECT
 
 public:
 
-    HTTP(QSettings *settings, QObject *parent = nullptr);
+    HTTP(quint16 port, bool reusePort = false, QObject *parent = nullptr, int descriptor = -1);
+    HTTP(const QString &path, QObject *parent = nullptr, int descriptor = -1);
+    ~HTTP(void);
+
+    inline int descriptor(void) { return m_server ? static_cast <int> (m_server->socketDescriptor()) : m_notifier ? static_cast <int> (m_notifier->socket()) : -1; }
+    inline void setSslConfiguration(const QSslConfiguration &value) { if (m_server) m_server->setSslConfiguration(value); }
+    inline void setAddressLimit(int value) { m_addressLimit = value; }
+
     void sendResponse(Request &request, quint16 code, const QMap <QString, QString> &headers = QMap <QString, QString> (), const QByteArray &response = QByteArray());
+    void sendResponse(Request &request, quint16 code, const QByteArray &headers, const QByteArray &response);
+    void sendStream(Request &request, quint16 code, const QMap <QString, QString> &headers, const Producer &producer);
 
 private:
 
-    QTcpServer *m_server;
+    struct Connection
+    {
+        QByteArray buffer;
+        QHostAddress address;
+        TimerWheel::Callback abort;
+        quint64 deadline;
+        qint64 length;
+        bool complete;
+    };
+
+    TlsServer *m_server;
+    QSocketNotifier *m_notifier;
+    Gauge *m_connections, *m_memory;
+    int m_addressLimit;
+
+    QHash <QIODevice*, Connection> m_pending;
+
+    QHash <QString, Counter*> m_requests;
+    QHash <QString, Histogram*> m_durations;
+
+    QByteArray status(quint16 code);
+    void observe(Request &request, quint16 code);
+
+    bool listenShared(quint16 port);
+    bool listenLocal(const QString &path);
+
+    void addConnection(QIODevice *socket, const TimerWheel::Callback &abort, const QHostAddress &address = QHostAddress());
+    void setDeadline(Connection &connection, int timeout);
+    void reject(Connection &connection, Counter *counter);
+
+    void parse(QIODevice *socket, const QByteArray &data);
 
 private slots:
 
     void newConnection(void);
+    void newLocalConnection(void);
     void readyRead(void);
 
 signals:
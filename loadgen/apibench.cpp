@@ -0,0 +1,479 @@
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRandomGenerator>
+#include <QUrl>
+#include <QUrlQuery>
+#include <QUuid>
+#include "apibench.h"
+
+ApiRequest::ApiRequest(const ApiOptions &options, QSslConfiguration *tls, const QByteArray &data, const std::function <void (const ApiResponse&)> &callback, QObject *parent) : QObject(parent), m_timer(new QTimer(this)), m_data(data), m_callback(callback), m_finished(false)
+{
+    connect(m_timer, &QTimer::timeout, this, &ApiRequest::finish);
+
+    m_timer->setSingleShot(true);
+    m_timer->start(API_REQUEST_TIMEOUT);
+
+    if (!options.socket.isEmpty())
+    {
+        QLocalSocket *socket = new QLocalSocket(this);
+
+        connect(socket, &QLocalSocket::connected, this, &ApiRequest::connected);
+        connect(socket, &QLocalSocket::stateChanged, this, [this] (QLocalSocket::LocalSocketState state) { if (state == QLocalSocket::UnconnectedState) finish(); });
+
+        m_socket = socket;
+        connect(m_socket, &QIODevice::readyRead, this, &ApiRequest::readyRead);
+        socket->connectToServer(options.socket);
+    }
+    else
+    {
+        QSslSocket *socket = new QSslSocket(this);
+
+        connect(socket, &QTcpSocket::stateChanged, this, [this] (QAbstractSocket::SocketState state) { if (state == QAbstractSocket::UnconnectedState) finish(); });
+
+        m_socket = socket;
+        connect(m_socket, &QIODevice::readyRead, this, &ApiRequest::readyRead);
+
+        if (tls)
+        {
+            connect(socket, &QSslSocket::encrypted, this, &ApiRequest::connected);
+            socket->setSslConfiguration(*tls);
+            socket->connectToHostEncrypted(options.host, options.port);
+            return;
+        }
+
+        connect(socket, &QTcpSocket::connected, this, &ApiRequest::connected);
+        socket->connectToHost(options.host, options.port);
+    }
+}
+
+void ApiRequest::connected(void)
+{
+    m_socket->write(m_data);
+}
+
+void ApiRequest::readyRead(void)
+{
+    m_buffer.append(m_socket->readAll());
+}
+
+void ApiRequest::finish(void)
+{
+    QList <QByteArray> head;
+    ApiResponse response;
+    int position;
+
+    if (m_finished)
+        return;
+
+    m_finished = true;
+    position = m_buffer.indexOf("\r\n\r\n");
+    head = m_buffer.left(position).split('\n');
+    response = {static_cast <quint16> (head.value(0).split(0x20).value(1).toInt()), {}, position < 0 ? QByteArray() : m_buffer.mid(position + 4)};
+
+    for (int i = 1; i < head.count(); i++)
+    {
+        int index = head.at(i).indexOf(':');
+
+        if (index < 0)
+            continue;
+
+        response.headers.insert(head.at(i).left(index).trimmed(), head.at(i).mid(index + 1).trimmed());
+    }
+
+    m_socket->close();
+    m_callback(response);
+    deleteLater();
+}
+
+ApiBench::ApiBench(const ApiOptions &options, QObject *parent) : QObject(parent), m_reportTimer(new QTimer(this)), m_options(options), m_active(0), m_session(0), m_weight(0), m_replayIndex(0), m_time(0)
+{
+    connect(m_reportTimer, &QTimer::timeout, this, &ApiBench::report);
+    connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, this, &ApiBench::summary);
+
+    m_tls = QSslConfiguration::defaultConfiguration();
+    m_tls.setPeerVerifyMode(QSslSocket::VerifyNone);
+}
+
+ApiBench::~ApiBench(void)
+{
+    qDeleteAll(m_routes);
+}
+
+bool ApiBench::start(void)
+{
+    QList <QString> mix = m_options.mix.split(',');
+    QFile file(m_options.tokens);
+
+    if (m_options.clientId.isEmpty() || m_options.clientSecret.isEmpty())
+    {
+        qWarning() << "Client id and secret are required for the API benchmark";
+        return false;
+    }
+
+    for (int i = 0; i < mix.count(); i++)
+    {
+        QList <QString> item = mix.at(i).split(':');
+        int weight = item.value(1, "1").toInt();
+
+        if (!QList <QString> ({"devices", "query", "action", "refresh", "token"}).contains(item.value(0)))
+        {
+            qWarning() << "Unknown route" << item.value(0) << "in API mix";
+            return false;
+        }
+
+        if (weight <= 0)
+            continue;
+
+        m_mix.append({item.value(0), weight});
+        m_weight += weight;
+    }
+
+    if (!m_options.replay.isEmpty())
+    {
+        QFile replay(m_options.replay);
+
+        if (!replay.open(QFile::ReadOnly))
+        {
+            qWarning() << "Can't open replay file" << m_options.replay;
+            return false;
+        }
+
+        while (!replay.atEnd())
+        {
+            QByteArray line = replay.readLine().trimmed();
+            int method = line.indexOf(' '), url = line.indexOf(' ', method + 1);
+
+            if (line.isEmpty() || line.startsWith('#') || method < 0)
+                continue;
+
+            m_replay.append({line.left(method), url < 0 ? line.mid(method + 1) : line.mid(method + 1, url - method - 1), url < 0 ? QByteArray() : line.mid(url + 1)});
+        }
+    }
+
+    if (!m_weight && m_replay.isEmpty())
+    {
+        qWarning() << "API mix is empty";
+        return false;
+    }
+
+    if (!file.open(QFile::ReadOnly))
+    {
+        qWarning() << "Can't open tokens file" << m_options.tokens;
+        return false;
+    }
+
+    while (!file.atEnd() && m_sessions.count() < m_options.users)
+    {
+        QList <QByteArray> line = file.readLine().trimmed().split(' ');
+
+        if (line.count() < 2)
+            continue;
+
+        m_sessions.append({line.at(0), QByteArray(), QByteArray(), {}, {}, false});
+    }
+
+    if (m_sessions.isEmpty())
+    {
+        qWarning() << "No user names found in" << m_options.tokens;
+        return false;
+    }
+
+    qInfo() << "API benchmark for" << m_sessions.count() << "users with concurrency" << m_options.concurrency << "starts in" << m_options.delay << "seconds";
+
+    QTimer::singleShot(m_options.delay * 1000, this, [this] () { m_elapsed.start(); m_reportTimer->start(API_REPORT_INTERVAL); dispatch(); });
+    return true;
+}
+
+void ApiBench::request(const QString &route, const QByteArray &method, const QString &url, const QByteArray &body, ApiSession *session, const std::function <void (const ApiResponse&)> &callback)
+{
+    QByteArray data = QString("%1 %2 HTTP/1.1\r\nHost: %3\r\nX-Request-Id: %4\r\n").arg(method.constData(), url, m_options.host, QUuid::createUuid().toString(QUuid::WithoutBraces)).toUtf8();
+    QElapsedTimer timer;
+
+    if (session && !session->accessToken.isEmpty())
+        data.append("Authorization: Bearer ").append(session->accessToken).append("\r\n");
+
+    if (!body.isEmpty())
+        data.append("Content-Type: ").append(body.startsWith('{') ? "application/json" : "application/x-www-form-urlencoded").append("\r\n");
+
+    data.append(QString("Content-Length: %1\r\n\r\n").arg(body.length()).toUtf8()).append(body);
+    timer.start();
+
+    new ApiRequest(m_options, m_options.tls ? &m_tls : nullptr, data, [this, route, timer, callback] (const ApiResponse &response)
+    {
+        record(route, timer.nsecsElapsed() / 1000, response.code == 200 || (response.code == 301 && response.headers.value("Location").contains("code=")));
+        callback(response);
+    }, this);
+}
+
+void ApiBench::record(const QString &route, qint64 time, bool success)
+{
+    ApiRoute *item = m_routes.value(route);
+
+    if (!item)
+    {
+        item = new ApiRoute();
+        m_routes.insert(route, item);
+    }
+
+    item->histogram.observe(time);
+
+    if (success)
+        return;
+
+    item->errors++;
+}
+
+void ApiBench::login(ApiSession *session)
+{
+    QByteArray body = QString("client_id=%1&username=%2&password=%3&redirect_uri=%4&state=loadgen").arg(QUrl::toPercentEncoding(m_options.clientId).constData(), QUrl::toPercentEncoding(session->name).constData(), QUrl::toPercentEncoding(m_options.password).constData(), QUrl::toPercentEncoding("https://social.yandex.net/broker/redirect").constData()).toUtf8();
+
+    session->accessToken.clear();
+
+    request("/login", "POST", "/login", body, session, [this, session] (const ApiResponse &response)
+    {
+        QString location = response.headers.value("Location");
+
+        if (response.code != 301 || !location.contains("code="))
+        {
+            done(session);
+            return;
+        }
+
+        token(session, location);
+    });
+}
+
+void ApiBench::token(ApiSession *session, const QString &location)
+{
+    QByteArray code = QUrlQuery(QUrl(location)).queryItemValue("code").toUtf8();
+    QByteArray body = QString("grant_type=authorization_code&client_id=%1&client_secret=%2&code=%3").arg(QUrl::toPercentEncoding(m_options.clientId).constData(), m_options.clientSecret.constData(), code.constData()).toUtf8();
+
+    request("/token", "POST", "/token", body, nullptr, [this, session] (const ApiResponse &response)
+    {
+        storeTokens(session, response);
+        done(session);
+    });
+}
+
+void ApiBench::refresh(ApiSession *session)
+{
+    QByteArray body = QString("grant_type=refresh_token&client_id=%1&client_secret=%2&refresh_token=%3").arg(QUrl::toPercentEncoding(m_options.clientId).constData(), m_options.clientSecret.constData(), session->refreshToken.constData()).toUtf8();
+
+    request("/refresh", "POST", "/refresh", body, nullptr, [this, session] (const ApiResponse &response)
+    {
+        storeTokens(session, response);
+        done(session);
+    });
+}
+
+void ApiBench::storeTokens(ApiSession *session, const ApiResponse &response)
+{
+    QJsonObject json = QJsonDocument::fromJson(response.body).object();
+
+    if (response.code != 200)
+    {
+        session->accessToken.clear();
+        return;
+    }
+
+    session->accessToken = json.value("access_token").toString().toUtf8();
+    session->refreshToken = json.value("refresh_token").toString().toUtf8();
+}
+
+void ApiBench::devices(ApiSession *session)
+{
+    request("/api/v1.0/user/devices", "GET", "/api/v1.0/user/devices", QByteArray(), session, [this, session] (const ApiResponse &response)
+    {
+        QJsonArray devices = QJsonDocument::fromJson(response.body).object().value("payload").toObject().value("devices").toArray();
+
+        if (response.code == 401)
+            session->accessToken.clear();
+
+        if (response.code == 200)
+        {
+            session->devices.clear();
+            session->switches.clear();
+
+            for (auto it = devices.begin(); it != devices.end(); it++)
+            {
+                QJsonObject device = it->toObject();
+                QJsonArray capabilities = device.value("capabilities").toArray();
+
+                session->devices.append(device.value("id").toString());
+
+                for (auto it = capabilities.begin(); it != capabilities.end(); it++)
+                {
+                    if (it->toObject().value("type").toString() != "devices.capabilities.on_off")
+                        continue;
+
+                    session->switches.append(device.value("id").toString());
+                    break;
+                }
+            }
+        }
+
+        done(session);
+    });
+}
+
+void ApiBench::query(ApiSession *session)
+{
+    QJsonArray devices;
+
+    for (int i = 0; i < qMin(session->devices.count(), 5); i++)
+        devices.append(QJsonObject {{"id", session->devices.at(QRandomGenerator::global()->bounded(session->devices.count()))}});
+
+    request("/api/v1.0/user/devices/query", "POST", "/api/v1.0/user/devices/query", QJsonDocument(QJsonObject {{"devices", devices}}).toJson(QJsonDocument::Compact), session, [this, session] (const ApiResponse &response)
+    {
+        if (response.code == 401)
+            session->accessToken.clear();
+
+        done(session);
+    });
+}
+
+void ApiBench::action(ApiSession *session)
+{
+    QJsonObject capability = {{"type", "devices.capabilities.on_off"}, {"state", QJsonObject {{"instance", "on"}, {"value", QRandomGenerator::global()->bounded(2) ? true : false}}}};
+    QJsonArray devices = {QJsonObject {{"id", session->switches.at(QRandomGenerator::global()->bounded(session->switches.count()))}, {"capabilities", QJsonArray {capability}}}};
+
+    request("/api/v1.0/user/devices/action", "POST", "/api/v1.0/user/devices/action", QJsonDocument(QJsonObject {{"payload", QJsonObject {{"devices", devices}}}}).toJson(QJsonDocument::Compact), session, [this, session] (const ApiResponse &response)
+    {
+        if (response.code == 401)
+            session->accessToken.clear();
+
+        done(session);
+    });
+}
+
+void ApiBench::replay(ApiSession *session)
+{
+    const QList <QByteArray> &item = m_replay.at(m_replayIndex++ % m_replay.count());
+    QByteArray body = item.at(2);
+
+    if (!session->devices.isEmpty())
+        body.replace("$DEVICE", session->devices.at(QRandomGenerator::global()->bounded(session->devices.count())).toUtf8());
+
+    if (!session->switches.isEmpty())
+        body.replace("$SWITCH", session->switches.at(QRandomGenerator::global()->bounded(session->switches.count())).toUtf8());
+
+    request(item.at(1), item.at(0), item.at(1), body, session, [this, session] (const ApiResponse &response)
+    {
+        if (response.code == 401)
+            session->accessToken.clear();
+
+        done(session);
+    });
+}
+
+void ApiBench::done(ApiSession *session)
+{
+    session->busy = false;
+    m_active--;
+
+    QTimer::singleShot(0, this, &ApiBench::dispatch);
+}
+
+void ApiBench::dispatch(void)
+{
+    while (m_active < m_options.concurrency)
+    {
+        ApiSession *session = nullptr;
+
+        for (int i = 0; i < m_sessions.count() && !session; i++)
+        {
+            ApiSession &item = m_sessions[m_session++ % m_sessions.count()];
+
+            if (item.busy)
+                continue;
+
+            session = &item;
+        }
+
+        if (!session)
+            break;
+
+        session->busy = true;
+        m_active++;
+
+        if (session->accessToken.isEmpty())
+        {
+            login(session);
+            continue;
+        }
+
+        if (!m_replay.isEmpty())
+        {
+            if (session->devices.isEmpty())
+                devices(session);
+            else
+                replay(session);
+
+            continue;
+        }
+
+        for (int i = 0, value = QRandomGenerator::global()->bounded(m_weight); i < m_mix.count(); i++)
+        {
+            const QString &route = m_mix.at(i).first;
+
+            if ((value -= m_mix.at(i).second) >= 0)
+                continue;
+
+            if (route == "token")
+                login(session);
+            else if (route == "refresh")
+                refresh(session);
+            else if (route == "devices" || session->devices.isEmpty() || (route == "action" && session->switches.isEmpty()))
+                devices(session);
+            else if (route == "query")
+                query(session);
+            else
+                action(session);
+
+            break;
+        }
+    }
+}
+
+void ApiBench::report(void)
+{
+    qint64 time = m_elapsed.elapsed();
+
+    for (auto it = m_routes.begin(); it != m_routes.end(); it++)
+    {
+        ApiRoute *route = it.value();
+        quint64 count = route->histogram.count();
+
+        qInfo().noquote() << QString("%1: %2 req/s, %3 total, %4 errors, p50 %5 ms, p90 %6 ms, p99 %7 ms").arg(it.key()).arg((count - route->last) * 1000.0 / (time - m_time), 0, 'f', 1).arg(count).arg(route->errors).arg(route->histogram.percentile(0.5) * 1000, 0, 'f', 2).arg(route->histogram.percentile(0.9) * 1000, 0, 'f', 2).arg(route->histogram.percentile(0.99) * 1000, 0, 'f', 2);
+        route->last = count;
+    }
+
+    m_time = time;
+}
+
+void ApiBench::summary(void)
+{
+    qint64 time = m_elapsed.isValid() ? m_elapsed.elapsed() : 0;
+
+    if (!time)
+        return;
+
+    for (auto it = m_routes.begin(); it != m_routes.end(); it++)
+    {
+        ApiRoute *route = it.value();
+        QString buckets;
+
+        for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        {
+            if (!route->histogram.bucket(i))
+                continue;
+
+            buckets.append(QString(" %1:%2").arg(i < HISTOGRAM_BUCKETS - 1 ? QString::number(Histogram::bound(i) * 1000) : "+Inf").arg(route->histogram.bucket(i)));
+        }
+
+        qInfo().noquote() << QString("%1: %2 requests, %3 req/s average, mean %4 ms, histogram (ms:count)%5").arg(it.key()).arg(route->histogram.count()).arg(route->histogram.count() * 1000.0 / time, 0, 'f', 1).arg(route->histogram.sum() / 1000.0 / qMax(route->histogram.count(), Q_UINT64_C(1)), 0, 'f', 2).arg(buckets);
+    }
+}
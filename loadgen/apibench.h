@@ -0,0 +1,117 @@
+#ifndef APIBENCH_H
+#define APIBENCH_H
+
+#define API_REQUEST_TIMEOUT     10000
+#define API_REPORT_INTERVAL     10000
+
+#include <functional>
+#include <QElapsedTimer>
+#include <QLocalSocket>
+#include <QSslConfiguration>
+#include <QSslSocket>
+#include <QTimer>
+#include "metrics.h"
+
+struct ApiOptions
+{
+    QString host, socket, tokens, mix, replay;
+    quint16 port;
+    int concurrency, users, delay;
+    bool tls;
+    QByteArray clientId, clientSecret, password;
+};
+
+struct ApiResponse
+{
+    quint16 code;
+    QMap <QString, QString> headers;
+    QByteArray body;
+};
+
+struct ApiSession
+{
+    QByteArray name, accessToken, refreshToken;
+    QList <QString> devices, switches;
+    bool busy;
+};
+
+struct ApiRoute
+{
+    Histogram histogram;
+    quint64 errors, last;
+};
+
+class ApiRequest : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    ApiRequest(const ApiOptions &options, QSslConfiguration *tls, const QByteArray &data, const std::function <void (const ApiResponse&)> &callback, QObject *parent);
+
+private:
+
+    QIODevice *m_socket;
+    QTimer *m_timer;
+    QByteArray m_data, m_buffer;
+    std::function <void (const ApiResponse&)> m_callback;
+    bool m_finished;
+
+private slots:
+
+    void connected(void);
+    void readyRead(void);
+    void finish(void);
+
+};
+
+class ApiBench : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    ApiBench(const ApiOptions &options, QObject *parent = nullptr);
+    ~ApiBench(void);
+
+    bool start(void);
+
+private:
+
+    QTimer *m_reportTimer;
+    ApiOptions m_options;
+    QElapsedTimer m_elapsed;
+    QSslConfiguration m_tls;
+
+    QList <ApiSession> m_sessions;
+    QList <QPair <QString, int>> m_mix;
+    QList <QList <QByteArray>> m_replay;
+    QMap <QString, ApiRoute*> m_routes;
+
+    int m_active, m_session, m_weight, m_replayIndex;
+    qint64 m_time;
+
+    void request(const QString &route, const QByteArray &method, const QString &url, const QByteArray &body, ApiSession *session, const std::function <void (const ApiResponse&)> &callback);
+    void record(const QString &route, qint64 time, bool success);
+
+    void login(ApiSession *session);
+    void token(ApiSession *session, const QString &location);
+    void refresh(ApiSession *session);
+    void storeTokens(ApiSession *session, const ApiResponse &response);
+
+    void devices(ApiSession *session);
+    void query(ApiSession *session);
+    void action(ApiSession *session);
+    void replay(ApiSession *session);
+
+    void done(ApiSession *session);
+
+private slots:
+
+    void dispatch(void);
+    void report(void);
+    void summary(void);
+
+};
+
+#endif
@@ -0,0 +1,22 @@
+QT = core network sql
+
+CONFIG += c++17 console
+
+INCLUDEPATH += ..
+
+SOURCES += \
+        ../crypto.cpp \
+        ../metrics.cpp \
+        apibench.cpp \
+        hub.cpp \
+        loadgen.cpp \
+        main.cpp
+
+HEADERS += \
+    ../crypto.h \
+    ../metrics.h \
+    apibench.h \
+    hub.h \
+    loadgen.h
+
+TARGET = homed-cloud-loadgen
@@ -0,0 +1,215 @@
+#include <QtEndian>
+#include <QCryptographicHash>
+#include <QRandomGenerator>
+#include "hub.h"
+
+Hub::Hub(int index, const QByteArray &token, const HubOptions &options, HubStats *stats, QObject *parent) : QObject(parent), m_socket(new QTcpSocket(this)), m_timer(new QTimer(this)), m_index(index), m_token(token), m_options(options), m_stats(stats), m_status(Status::Idle), m_device(0)
+{
+    connect(m_socket, &QTcpSocket::connected, this, &Hub::connected);
+    connect(m_socket, &QTcpSocket::disconnected, this, &Hub::disconnected);
+    connect(m_socket, &QTcpSocket::readyRead, this, &Hub::readyRead);
+    connect(m_timer, &QTimer::timeout, this, &Hub::update);
+}
+
+void Hub::start(void)
+{
+    m_socket->connectToHost(m_options.host, m_options.port);
+}
+
+QString Hub::deviceId(int device)
+{
+    QByteArray data(8, 0);
+    qToBigEndian(Q_UINT64_C(0x00124B0000000000) | static_cast <quint64> (m_index & 0xFFFFFF) << 16 | static_cast <quint64> (device & 0xFFFF), data.data());
+    return QString(data.toHex(':'));
+}
+
+QJsonObject Hub::deviceData(int device)
+{
+    QRandomGenerator *random = QRandomGenerator::global();
+
+    switch (device % 4)
+    {
+        case 0:  return {{"temperature", 20 + random->bounded(100) / 10.0}, {"humidity", 30 + random->bounded(400) / 10.0}, {"battery", random->bounded(100)}};
+        case 1:  return {{"status", random->bounded(2) ? "on" : "off"}};
+        case 2:  return {{"status", random->bounded(2) ? "on" : "off"}, {"level", random->bounded(1, 255)}};
+        default: return {{"contact", random->bounded(2) ? true : false}, {"battery", random->bounded(100)}};
+    }
+}
+
+void Hub::sendFrame(const QJsonObject &json)
+{
+    QByteArray buffer = QJsonDocument(json).toJson(QJsonDocument::Compact), packet = QByteArray(1, 0x42);
+
+    if (buffer.length() % 16)
+        buffer.append(16 - buffer.length() % 16, 0);
+
+    m_aes.cbcEncrypt(buffer);
+
+    for (int i = 0; i < buffer.length(); i++)
+    {
+        switch (buffer.at(i))
+        {
+            case 0x42: packet.append(0x44).append(0x62); break;
+            case 0x43: packet.append(0x44).append(0x63); break;
+            case 0x44: packet.append(0x44).append(0x64); break;
+            default:   packet.append(buffer.at(i)); break;
+        }
+    }
+
+    m_socket->write(packet.append(0x43));
+    m_stats->framesOut++;
+    m_stats->bytesOut += packet.length();
+}
+
+void Hub::publish(const QString &topic, const QJsonObject &message)
+{
+    sendFrame({{"action", "publish"}, {"topic", topic}, {"message", message}});
+}
+
+void Hub::parseFrame(QByteArray &buffer)
+{
+    QJsonObject json, message;
+    QString topic;
+
+    m_aes.cbcDecrypt(buffer);
+    json = QJsonDocument::fromJson(buffer.constData()).object();
+    message = json.value("message").toObject();
+    topic = json.value("topic").toString();
+
+    m_stats->framesIn++;
+
+    if (json.value("action").toString() != "publish")
+        return;
+
+    if (topic.startsWith("td/"))
+    {
+        publish(QString("fd/").append(topic.mid(3)), message);
+        m_stats->actions++;
+    }
+    else if (topic.startsWith("command/") && message.value("action").toString() == "getProperties")
+    {
+        QString device = message.value("device").toString();
+
+        for (int i = 0; i < m_options.devices; i++)
+        {
+            if (deviceId(i) != device)
+                continue;
+
+            publish(QString("fd/zigbee/").append(device), deviceData(i));
+            break;
+        }
+    }
+}
+
+void Hub::sendDevices(void)
+{
+    QJsonArray devices;
+
+    for (int i = 0; i < m_options.devices; i++)
+        devices.append(QJsonObject {{"ieeeAddress", deviceId(i)}, {"name", QString("Device %1").arg(i)}, {"description", "loadgen"}, {"cloud", true}});
+
+    publish("status/zigbee", {{"devices", devices}, {"names", false}});
+
+    for (int i = 0; i < m_options.devices; i++)
+    {
+        QString id = deviceId(i);
+        QJsonObject expose;
+
+        switch (i % 4)
+        {
+            case 0:  expose = {{"items", QJsonArray {"temperature", "humidity", "battery"}}}; break;
+            case 1:  expose = {{"items", QJsonArray {"switch"}}, {"options", QJsonObject {{"switch", "outlet"}}}}; break;
+            case 2:  expose = {{"items", QJsonArray {"light"}}, {"options", QJsonObject {{"light", QJsonArray {"level"}}}}}; break;
+            default: expose = {{"items", QJsonArray {"contact", "battery"}}}; break;
+        }
+
+        publish(QString("expose/zigbee/").append(id), {{"common", expose}});
+        publish(QString("device/zigbee/").append(id), {{"status", "online"}});
+    }
+}
+
+void Hub::connected(void)
+{
+    handshakeRequest request = {qToBigEndian(m_dh.prime()), qToBigEndian(m_dh.generator()), qToBigEndian(m_dh.sharedKey())};
+
+    m_socket->write(reinterpret_cast <char*> (&request), sizeof(request));
+    m_status = Status::Handshake;
+    m_stats->connected++;
+}
+
+void Hub::disconnected(void)
+{
+    if (m_status == Status::Ready)
+        m_stats->ready--;
+
+    m_timer->stop();
+    m_status = Status::Idle;
+    m_stats->connected--;
+    m_stats->closed++;
+}
+
+void Hub::readyRead(void)
+{
+    m_buffer.append(m_socket->readAll());
+
+    if (m_status == Status::Handshake)
+    {
+        QByteArray hash;
+        quint32 value, key;
+
+        if (m_buffer.length() < static_cast <int> (sizeof(value)))
+            return;
+
+        memcpy(&value, m_buffer.constData(), sizeof(value));
+        m_buffer.remove(0, sizeof(value));
+
+        key = qToBigEndian(m_dh.privateKey(qFromBigEndian(value)));
+        hash = QCryptographicHash::hash(QByteArray(reinterpret_cast <char*> (&key), sizeof(key)), QCryptographicHash::Md5);
+
+        m_aes.init(hash, QCryptographicHash::hash(hash, QCryptographicHash::Md5));
+        m_status = Status::Ready;
+        m_stats->ready++;
+
+        sendFrame({{"uniqueId", QString("loadgen-%1").arg(m_index)}, {"token", QString(m_token.toHex())}});
+        sendDevices();
+
+        if (m_options.rate > 0)
+        {
+            m_timer->start(static_cast <int> (1000 / m_options.rate));
+            m_device = QRandomGenerator::global()->bounded(qMax(m_options.devices, 1));
+        }
+    }
+
+    while (m_status == Status::Ready)
+    {
+        int length = m_buffer.indexOf(0x43);
+        QByteArray buffer;
+
+        if (length < 0)
+            break;
+
+        for (int i = 0; i < length; i++)
+        {
+            switch (m_buffer.at(i))
+            {
+                case 0x42: buffer.clear(); break;
+                case 0x44: buffer.append(m_buffer.at(++i) & 0xDF); break;
+                default:   buffer.append(m_buffer.at(i)); break;
+            }
+        }
+
+        m_buffer.remove(0, length + 1);
+
+        if (!buffer.isEmpty())
+            parseFrame(buffer);
+    }
+}
+
+void Hub::update(void)
+{
+    if (!m_options.devices)
+        return;
+
+    m_device = (m_device + 1) % m_options.devices;
+    publish(QString("fd/zigbee/").append(deviceId(m_device)), deviceData(m_device));
+}
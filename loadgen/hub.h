@@ -0,0 +1,82 @@
+#ifndef HUB_H
+#define HUB_H
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTcpSocket>
+#include <QTimer>
+#include "crypto.h"
+
+struct HubOptions
+{
+    QString host;
+    quint16 port;
+    int devices;
+    double rate;
+};
+
+struct HubStats
+{
+    quint64 connected, ready, closed, framesIn, framesOut, bytesOut, actions;
+};
+
+class Hub : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    Hub(int index, const QByteArray &token, const HubOptions &options, HubStats *stats, QObject *parent = nullptr);
+
+    inline bool ready(void) { return m_status == Status::Ready; }
+    void start(void);
+
+private:
+
+    enum class Status
+    {
+        Idle,
+        Handshake,
+        Ready
+    };
+
+    struct handshakeRequest
+    {
+        quint32 prime;
+        quint32 generator;
+        quint32 sharedKey;
+    };
+
+    QTcpSocket *m_socket;
+    QTimer *m_timer;
+    AES128 m_aes;
+    DH m_dh;
+
+    int m_index;
+    QByteArray m_token, m_buffer;
+    HubOptions m_options;
+    HubStats *m_stats;
+    Status m_status;
+
+    int m_device;
+
+    QString deviceId(int device);
+    QJsonObject deviceData(int device);
+
+    void sendFrame(const QJsonObject &json);
+    void publish(const QString &topic, const QJsonObject &message);
+    void parseFrame(QByteArray &buffer);
+
+    void sendDevices(void);
+
+private slots:
+
+    void connected(void);
+    void disconnected(void);
+    void readyRead(void);
+    void update(void);
+
+};
+
+#endif
@@ -0,0 +1,231 @@
+#include <math.h>
+#include <algorithm>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QFile>
+#include <QRandomGenerator>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include "loadgen.h"
+
+LoadGen::LoadGen(const LoadOptions &options, QObject *parent) : QObject(parent), m_rampTimer(new QTimer(this)), m_reportTimer(new QTimer(this)), m_manager(new QNetworkAccessManager(this)), m_options(options), m_stats({0, 0, 0, 0, 0, 0, 0}), m_time(0)
+{
+    connect(m_rampTimer, &QTimer::timeout, this, &LoadGen::ramp);
+    connect(m_reportTimer, &QTimer::timeout, this, &LoadGen::report);
+    connect(m_manager, &QNetworkAccessManager::finished, this, &LoadGen::finished);
+}
+
+bool LoadGen::seed(const QString &database, const QString &tokens, const QString &password, int count)
+{
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "seed");
+    QFile file(tokens);
+    bool result = true;
+
+    db.setDatabaseName(database);
+
+    if (!db.open() || !file.open(QFile::WriteOnly | QFile::Truncate))
+    {
+        qWarning() << "Can't open" << database << "or" << tokens;
+        return false;
+    }
+
+    {
+        QSqlQuery query(db);
+        qint64 timestamp = QDateTime::currentSecsSinceEpoch();
+
+        query.exec("CREATE TABLE IF NOT EXISTS users (chat INTEGER PRIMARY KEY, name TEXT, hash TEXT, clientToken TEXT, accessToken TEXT, refreshToken TEXT, tokenExpire INTEGER, timestamp INTEGER)");
+        query.prepare("INSERT INTO users (chat, name, hash, clientToken, timestamp) VALUES (:chat, :name, :hash, :clientToken, :timestamp) ON CONFLICT (chat) DO UPDATE SET name = excluded.name, hash = excluded.hash, clientToken = excluded.clientToken, accessToken = NULL, refreshToken = NULL, tokenExpire = NULL, timestamp = excluded.timestamp");
+
+        db.transaction();
+
+        for (int i = 0; i < count; i++)
+        {
+            QByteArray name = QString("loadgen_%1").arg(i).toUtf8(), salt(16, 0), token(32, 0);
+
+            QRandomGenerator::global()->fillRange(reinterpret_cast <quint32*> (salt.data()), salt.length() / 4);
+            QRandomGenerator::global()->fillRange(reinterpret_cast <quint32*> (token.data()), token.length() / 4);
+
+            query.bindValue(":chat", LOADGEN_CHAT_BASE + i);
+            query.bindValue(":name", QString(name));
+            query.bindValue(":hash", QString(salt.toHex().append(QCryptographicHash::hash(QByteArray(salt).append(password.toUtf8()), QCryptographicHash::Md5).toHex())));
+            query.bindValue(":clientToken", QString(token.toHex()));
+            query.bindValue(":timestamp", timestamp);
+
+            if (!query.exec())
+            {
+                qWarning() << "Database insert error" << query.lastError().text();
+                result = false;
+                break;
+            }
+
+            file.write(name.append(' ').append(token.toHex()).append('\n'));
+        }
+
+        db.commit();
+    }
+
+    db.close();
+    qInfo() << "Seeded" << count << "users into" << database << "with tokens in" << tokens;
+    return result;
+}
+
+QMap <QString, double> LoadGen::parseMetrics(const QByteArray &data)
+{
+    QList <QByteArray> lines = data.split('\n');
+    QMap <QString, double> metrics;
+
+    for (int i = 0; i < lines.count(); i++)
+    {
+        const QByteArray &line = lines.at(i);
+        int position = line.lastIndexOf(' ');
+
+        if (line.isEmpty() || line.startsWith('#') || position < 0)
+            continue;
+
+        metrics.insert(line.left(position), line.mid(position + 1).toDouble());
+    }
+
+    return metrics;
+}
+
+bool LoadGen::start(void)
+{
+    QFile file(m_options.tokens);
+
+    if (!file.open(QFile::ReadOnly))
+    {
+        qWarning() << "Can't open tokens file" << m_options.tokens;
+        return false;
+    }
+
+    while (!file.atEnd())
+    {
+        QByteArray line = file.readLine().trimmed();
+
+        if (line.isEmpty())
+            continue;
+
+        m_tokens.append(QByteArray::fromHex(line.mid(line.lastIndexOf(' ') + 1)));
+    }
+
+    if (m_tokens.isEmpty())
+    {
+        qWarning() << "No tokens found in" << m_options.tokens;
+        return false;
+    }
+
+    qInfo() << "Starting" << m_options.connections << "hubs with" << m_options.hub.devices << "devices each," << m_tokens.count() << "tokens available";
+
+    if (!m_options.metrics.isEmpty())
+        m_manager->get(QNetworkRequest(QUrl(m_options.metrics)));
+
+    m_elapsed.start();
+    m_rampTimer->start(RAMP_INTERVAL);
+    m_reportTimer->start(REPORT_INTERVAL);
+
+    ramp();
+    return true;
+}
+
+double LoadGen::percentile(const QMap <QString, double> &metrics, const QString &name, double value)
+{
+    QString prefix = QString("%1_bucket{le=\"").arg(name);
+    QList <QPair <double, double>> buckets;
+    double total, rank, lower = 0, previous = 0;
+
+    for (auto it = metrics.begin(); it != metrics.end(); it++)
+    {
+        QString bound;
+
+        if (!it.key().startsWith(prefix))
+            continue;
+
+        bound = it.key().mid(prefix.length()).chopped(2);
+        buckets.append({bound == "+Inf" ? INFINITY : bound.toDouble(), it.value() - m_metrics.value(it.key())});
+    }
+
+    std::sort(buckets.begin(), buckets.end());
+
+    if (buckets.isEmpty() || !(total = buckets.last().second))
+        return 0;
+
+    rank = ceil(total * value);
+
+    for (int i = 0; i < buckets.count(); i++)
+    {
+        double bound = buckets.at(i).first, count = buckets.at(i).second;
+
+        if (count < rank)
+        {
+            lower = bound;
+            previous = count;
+            continue;
+        }
+
+        return std::isinf(bound) ? lower : lower + (bound - lower) * (rank - previous) / (count - previous);
+    }
+
+    return lower;
+}
+
+void LoadGen::ramp(void)
+{
+    int count = qMax(m_options.ramp * RAMP_INTERVAL / 1000, 1);
+
+    for (int i = 0; i < count && m_hubs.count() < m_options.connections; i++)
+    {
+        Hub *hub = new Hub(m_hubs.count(), m_tokens.at(m_hubs.count() % m_tokens.count()), m_options.hub, &m_stats, this);
+        m_hubs.append(hub);
+        hub->start();
+    }
+
+    if (m_hubs.count() < m_options.connections)
+        return;
+
+    qInfo() << "All" << m_hubs.count() << "hubs started in" << m_elapsed.elapsed() << "ms";
+    m_rampTimer->stop();
+}
+
+void LoadGen::report(void)
+{
+    qInfo().noquote() << QString("Hubs: %1 connected, %2 ready, %3 closed; frames: %4 sent (%5 bytes), %6 received, %7 actions confirmed").arg(m_stats.connected).arg(m_stats.ready).arg(m_stats.closed).arg(m_stats.framesOut).arg(m_stats.bytesOut).arg(m_stats.framesIn).arg(m_stats.actions);
+
+    if (m_options.metrics.isEmpty())
+        return;
+
+    m_manager->get(QNetworkRequest(QUrl(m_options.metrics)));
+}
+
+void LoadGen::finished(QNetworkReply *reply)
+{
+    QMap <QString, double> metrics;
+    qint64 time = m_elapsed.elapsed();
+    QString frames = "hub_frames_total{direction=\"in\"}";
+
+    reply->deleteLater();
+
+    if (reply->error() != QNetworkReply::NoError)
+    {
+        qWarning() << "Metrics request failed:" << reply->errorString();
+        return;
+    }
+
+    metrics = parseMetrics(reply->readAll());
+
+    if (m_baseline.isEmpty())
+        m_baseline = metrics;
+
+    if (!m_metrics.isEmpty())
+    {
+        double clients = metrics.value("hub_clients") - m_baseline.value("hub_clients"), memory = metrics.value("process_resident_memory_bytes") - m_baseline.value("process_resident_memory_bytes");
+
+        qInfo().noquote() << QString("Server: %1 frames/s, frame-to-callback p50 %2 ms, p99 %3 ms, RSS %4 MiB, %5 hub clients").arg((metrics.value(frames) - m_metrics.value(frames)) * 1000 / (time - m_time), 0, 'f', 0).arg(percentile(metrics, "hub_frame_callback_seconds", 0.5) * 1000, 0, 'f', 3).arg(percentile(metrics, "hub_frame_callback_seconds", 0.99) * 1000, 0, 'f', 3).arg(metrics.value("process_resident_memory_bytes") / 1048576, 0, 'f', 1).arg(metrics.value("hub_clients"));
+
+        if (clients > 0)
+            qInfo().noquote() << QString("Server memory: %1 bytes per hub with %2 devices").arg(memory / clients, 0, 'f', 0).arg(m_options.hub.devices);
+    }
+
+    m_metrics = metrics;
+    m_time = time;
+}
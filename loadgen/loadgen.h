@@ -0,0 +1,58 @@
+#ifndef LOADGEN_H
+#define LOADGEN_H
+
+#define REPORT_INTERVAL     10000
+#define RAMP_INTERVAL       100
+#define LOADGEN_CHAT_BASE   Q_INT64_C(9000000000000)
+
+#include <QElapsedTimer>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include "hub.h"
+
+struct LoadOptions
+{
+    HubOptions hub;
+    int connections, ramp;
+    QString tokens, metrics;
+};
+
+class LoadGen : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    LoadGen(const LoadOptions &options, QObject *parent = nullptr);
+
+    static bool seed(const QString &database, const QString &tokens, const QString &password, int count);
+    static QMap <QString, double> parseMetrics(const QByteArray &data);
+
+    bool start(void);
+
+private:
+
+    QTimer *m_rampTimer, *m_reportTimer;
+    QNetworkAccessManager *m_manager;
+
+    LoadOptions m_options;
+    HubStats m_stats;
+    QElapsedTimer m_elapsed;
+
+    QList <QByteArray> m_tokens;
+    QList <Hub*> m_hubs;
+
+    QMap <QString, double> m_metrics, m_baseline;
+    qint64 m_time;
+
+    double percentile(const QMap <QString, double> &metrics, const QString &name, double value);
+
+private slots:
+
+    void ramp(void);
+    void report(void);
+    void finished(QNetworkReply *reply);
+
+};
+
+#endif
@@ -0,0 +1,51 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include "apibench.h"
+#include "loadgen.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCommandLineParser parser;
+    LoadOptions options;
+    ApiOptions api;
+
+    parser.setApplicationDescription("HOMEd cloud server hub simulator and load generator");
+    parser.addHelpOption();
+    parser.addOptions({{"host", "Server host", "host", "127.0.0.1"}, {"port", "Server hub port", "port", "8042"}, {"connections", "Number of simulated hubs", "count", "1000"}, {"devices", "Devices per hub", "count", "20"}, {"rate", "State updates per second per hub", "rate", "0.1"}, {"ramp", "New connections per second", "count", "500"}, {"tokens", "Tokens file, one \"name token\" pair per line", "file", "loadgen.tokens"}, {"metrics", "Server admin metrics URL", "url", "http://127.0.0.1:8085/metrics"}, {"duration", "Run time in seconds, 0 to run until interrupted", "seconds", "0"}, {"seed", "Create users in the database and write the tokens file, then exit", "count"}, {"database", "Database file for seeding", "file", "/var/db/homed-cloud.sqlite"}, {"password", "Password for seeded users", "password", "loadgen"}, {"api-port", "Server HTTP port", "port", "8084"}, {"api-concurrency", "Parallel HTTP requests, 0 disables the API benchmark", "count", "0"}, {"api-users", "Users logged in by the API benchmark", "count", "100"}, {"api-mix", "Route weights", "mix", "devices:1,query:8,action:1,refresh:0,token:0"}, {"api-replay", "Replay file, one \"METHOD URL [BODY]\" request per line", "file"}, {"api-delay", "Seconds to wait for hubs before the API benchmark starts", "seconds", "10"}, {"api-tls", "Use TLS for API requests, one full handshake per request"}, {"api-socket", "Server HTTP unix socket, used instead of the HTTP port", "path"}, {"client-id", "Yandex client id configured on the server", "id"}, {"client-secret", "Yandex client secret configured on the server, hex", "secret"}});
+    parser.process(a);
+
+    if (parser.isSet("seed"))
+        return LoadGen::seed(parser.value("database"), parser.value("tokens"), parser.value("password"), parser.value("seed").toInt()) ? 0 : 1;
+
+    api.host = parser.value("host");
+    api.port = static_cast <quint16> (parser.value("api-port").toInt());
+    api.tokens = parser.value("tokens");
+    api.mix = parser.value("api-mix");
+    api.replay = parser.value("api-replay");
+    api.concurrency = parser.value("api-concurrency").toInt();
+    api.users = parser.value("api-users").toInt();
+    api.delay = parser.value("api-delay").toInt();
+    api.tls = parser.isSet("api-tls");
+    api.socket = parser.value("api-socket");
+    api.clientId = parser.value("client-id").toUtf8();
+    api.clientSecret = parser.value("client-secret").toUtf8();
+    api.password = parser.value("password").toUtf8();
+
+    options.hub = {parser.value("host"), static_cast <quint16> (parser.value("port").toInt()), parser.value("devices").toInt(), parser.value("rate").toDouble()};
+    options.connections = parser.value("connections").toInt();
+    options.ramp = parser.value("ramp").toInt();
+    options.tokens = parser.value("tokens");
+    options.metrics = parser.value("metrics");
+
+    if (options.connections && !(new LoadGen(options, &a))->start())
+        return 1;
+
+    if (api.concurrency && !(new ApiBench(api, &a))->start())
+        return 1;
+
+    if (parser.value("duration").toInt())
+        QTimer::singleShot(parser.value("duration").toInt() * 1000, &a, &QCoreApplication::quit);
+
+    return a.exec();
+}
@@ -1,3 +1,4 @@
+#include <QCommandLineParser>
 #include <QCoreApplication>
 #include <QDebug>
 #include "controller.h"
@@ -5,6 +6,13 @@
 int main(int argc, char *argv[])
 {
     QCoreApplication a(argc, argv);
-    new Controller;
+    QCommandLineParser parser;
+
+    parser.setApplicationDescription("HOMEd cloud server");
+    parser.addHelpOption();
+    parser.addOption({{"c", "config"}, "Configuration file", "file", "/etc/homed/homed-cloud-server.conf"});
+    parser.process(a);
+
+    new Controller(parser.value("config"));
     return a.exec();
 }
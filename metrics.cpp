@@ -0,0 +1,172 @@
+#include <math.h>
+#include <QDebug>
+#include <QFile>
+#include "metrics.h"
+
+#ifdef RRD_SUPPORT
+#include <rrd.h>
+#endif
+
+static const double bounds[HISTOGRAM_BUCKETS - 1] = {0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30};
+
+double Histogram::bound(int index)
+{
+    return index < HISTOGRAM_BUCKETS - 1 ? bounds[index] : INFINITY;
+}
+
+void Histogram::observe(qint64 microseconds)
+{
+    int index = 0;
+
+    while (index < HISTOGRAM_BUCKETS - 1 && microseconds > bounds[index] * 1e6)
+        index++;
+
+    m_buckets[index].fetchAndAddRelaxed(1);
+    m_count.fetchAndAddRelaxed(1);
+    m_sum.fetchAndAddRelaxed(static_cast <quint64> (microseconds));
+}
+
+double Histogram::percentile(double value)
+{
+    quint64 count = m_count.loadRelaxed(), rank = static_cast <quint64> (ceil(count * value)), total = 0;
+
+    if (!count)
+        return 0;
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        quint64 bucket = m_buckets[i].loadRelaxed();
+        double lower = i ? bounds[i - 1] : 0;
+
+        if (total + bucket < rank)
+        {
+            total += bucket;
+            continue;
+        }
+
+        return i < HISTOGRAM_BUCKETS - 1 ? lower + (bounds[i] - lower) * (rank - total) / bucket : lower;
+    }
+
+    return bounds[HISTOGRAM_BUCKETS - 2];
+}
+
+Metrics *Metrics::instance(void)
+{
+    static Metrics metrics;
+    return &metrics;
+}
+
+Counter *Metrics::counter(const QString &name, const QString &labels)
+{
+    QMutexLocker lock(&m_mutex);
+    Counter *counter = m_counters[name].value(labels);
+
+    if (!counter)
+    {
+        counter = new Counter;
+        m_counters[name].insert(labels, counter);
+    }
+
+    return counter;
+}
+
+Gauge *Metrics::gauge(const QString &name, const QString &labels)
+{
+    QMutexLocker lock(&m_mutex);
+    Gauge *gauge = m_gauges[name].value(labels);
+
+    if (!gauge)
+    {
+        gauge = new Gauge;
+        m_gauges[name].insert(labels, gauge);
+    }
+
+    return gauge;
+}
+
+Histogram *Metrics::histogram(const QString &name, const QString &labels)
+{
+    QMutexLocker lock(&m_mutex);
+    Histogram *histogram = m_histograms[name].value(labels);
+
+    if (!histogram)
+    {
+        histogram = new Histogram;
+        m_histograms[name].insert(labels, histogram);
+    }
+
+    return histogram;
+}
+
+QByteArray Metrics::exposition(void)
+{
+    QMutexLocker lock(&m_mutex);
+    QByteArray data;
+
+    for (auto it = m_counters.begin(); it != m_counters.end(); it++)
+    {
+        data.append(QString("# TYPE %1 counter\n").arg(it.key()).toUtf8());
+
+        for (auto item = it.value().begin(); item != it.value().end(); item++)
+            data.append(QString("%1%2 %3\n").arg(it.key(), item.key().isEmpty() ? QString() : QString("{%1}").arg(item.key())).arg(item.value()->value()).toUtf8());
+    }
+
+    for (auto it = m_gauges.begin(); it != m_gauges.end(); it++)
+    {
+        data.append(QString("# TYPE %1 gauge\n").arg(it.key()).toUtf8());
+
+        for (auto item = it.value().begin(); item != it.value().end(); item++)
+            data.append(QString("%1%2 %3\n").arg(it.key(), item.key().isEmpty() ? QString() : QString("{%1}").arg(item.key())).arg(item.value()->value()).toUtf8());
+    }
+
+    for (auto it = m_histograms.begin(); it != m_histograms.end(); it++)
+    {
+        data.append(QString("# TYPE %1 histogram\n").arg(it.key()).toUtf8());
+
+        for (auto item = it.value().begin(); item != it.value().end(); item++)
+        {
+            Histogram *histogram = item.value();
+            QString prefix = item.key().isEmpty() ? QString() : QString("%1,").arg(item.key()), labels = item.key().isEmpty() ? QString() : QString("{%1}").arg(item.key());
+            quint64 total = 0;
+
+            for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+            {
+                total += histogram->bucket(i);
+                data.append(QString("%1_bucket{%2le=\"%3\"} %4\n").arg(it.key(), prefix, i < HISTOGRAM_BUCKETS - 1 ? QString::number(Histogram::bound(i)) : "+Inf").arg(total).toUtf8());
+            }
+
+            data.append(QString("%1_sum%2 %3\n").arg(it.key(), labels).arg(histogram->sum() / 1e6).toUtf8());
+            data.append(QString("%1_count%2 %3\n").arg(it.key(), labels).arg(histogram->count()).toUtf8());
+        }
+    }
+
+    return data;
+}
+
+#ifdef RRD_SUPPORT
+
+void RRD::update(const QString &name, qint64 time, double value)
+{
+    QByteArray file = QString("%1/%2.rrd").arg(m_path, name).toUtf8(), data = QString("%1:%2").arg(time - time % 10).arg(value).toUtf8();
+    const char *update[] = {data.constData()};
+
+    if (!QFile::exists(file))
+    {
+        const char *create[] = {"DS:data:GAUGE:3600:U:U", "RRA:AVERAGE:0.5:1:8640", "RRA:AVERAGE:0.5:60:1008", "RRA:AVERAGE:0.5:360:744", "RRA:AVERAGE:0.5:2160:1460"};
+
+        if (rrd_create_r(file.constData(), 10, time - time % 10 - 10, 5, create))
+        {
+            qWarning() << "RRD create error:" << rrd_get_error();
+            rrd_clear_error();
+            return;
+        }
+    }
+
+    if (!rrd_update_r(file.constData(), nullptr, 1, update))
+        return;
+
+    qWarning() << "RRD update error:" << rrd_get_error();
+    rrd_clear_error();
+}
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#define HISTOGRAM_BUCKETS   16
+
+#include <QAtomicInteger>
+#include <QMap>
+#include <QMutex>
+
+class Counter
+{
+
+public:
+
+    Counter(void) : m_value(0) {}
+
+    inline void increment(quint64 value = 1) { m_value.fetchAndAddRelaxed(value); }
+    inline quint64 value(void) { return m_value.loadRelaxed(); }
+
+private:
+
+    QAtomicInteger <quint64> m_value;
+
+};
+
+class Gauge
+{
+
+public:
+
+    Gauge(void) : m_value(0) {}
+
+    inline void set(qint64 value) { m_value.storeRelaxed(value); }
+    inline void add(qint64 value) { m_value.fetchAndAddRelaxed(value); }
+    inline qint64 value(void) { return m_value.loadRelaxed(); }
+
+private:
+
+    QAtomicInteger <qint64> m_value;
+
+};
+
+class Histogram
+{
+
+public:
+
+    static double bound(int index);
+
+    void observe(qint64 microseconds);
+    double percentile(double value);
+
+    inline quint64 bucket(int index) { return m_buckets[index].loadRelaxed(); }
+    inline quint64 count(void) { return m_count.loadRelaxed(); }
+    inline quint64 sum(void) { return m_sum.loadRelaxed(); }
+
+private:
+
+    QAtomicInteger <quint64> m_buckets[HISTOGRAM_BUCKETS], m_count, m_sum;
+
+};
+
+class Metrics
+{
+
+public:
+
+    static Metrics *instance(void);
+
+    Counter *counter(const QString &name, const QString &labels = QString());
+    Gauge *gauge(const QString &name, const QString &labels = QString());
+    Histogram *histogram(const QString &name, const QString &labels = QString());
+
+    QByteArray exposition(void);
+
+private:
+
+    QMutex m_mutex;
+
+    QMap <QString, QMap <QString, Counter*>> m_counters;
+    QMap <QString, QMap <QString, Gauge*>> m_gauges;
+    QMap <QString, QMap <QString, Histogram*>> m_histograms;
+
+};
+
+#ifdef RRD_SUPPORT
+
+class RRD
+{
+
+public:
+
+    RRD(const QString &path) : m_path(path) {}
+    void update(const QString &name, qint64 time, double value);
+
+private:
+
+    QString m_path;
+
+};
+
+#endif
+
+#endif
@@ -0,0 +1,88 @@
+#include <unistd.h>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QSslKey>
+#include "tls.h"
+
+static Counter *handshakesDone = Metrics::instance()->counter("tls_handshakes_total", "result=\"ok\"");
+static Counter *handshakesFailed = Metrics::instance()->counter("tls_handshakes_total", "result=\"error\"");
+static Histogram *handshakeTime = Metrics::instance()->histogram("tls_handshake_seconds");
+
+QSslConfiguration TLS::configuration(const QString &certificate, const QString &key)
+{
+    QSslConfiguration configuration = QSslConfiguration::defaultConfiguration();
+    QList <QSslCertificate> chain = QSslCertificate::fromPath(certificate);
+    QFile file(key);
+    QSslKey privateKey;
+
+    if (certificate.isEmpty())
+        return QSslConfiguration();
+
+    if (chain.isEmpty() || !file.open(QFile::ReadOnly))
+    {
+        qWarning() << "TLS certificate" << certificate << "or key" << key << "is not available";
+        return QSslConfiguration();
+    }
+
+    privateKey = QSslKey(file.readAll(), QSsl::Rsa);
+
+    if (privateKey.isNull())
+    {
+        file.seek(0);
+        privateKey = QSslKey(file.readAll(), QSsl::Ec);
+    }
+
+    if (privateKey.isNull())
+    {
+        qWarning() << "TLS key" << key << "is not valid";
+        return QSslConfiguration();
+    }
+
+    configuration.setLocalCertificateChain(chain);
+    configuration.setPrivateKey(privateKey);
+    configuration.setPeerVerifyMode(QSslSocket::VerifyNone);
+
+    return configuration;
+}
+
+QSslSocket *TLS::socket(qintptr descriptor, const QSslConfiguration &configuration)
+{
+    QSslSocket *socket = new QSslSocket;
+    QElapsedTimer timer;
+
+    if (!socket->setSocketDescriptor(descriptor))
+    {
+        qWarning() << "Socket descriptor" << descriptor << "setup failed:" << socket->errorString();
+        ::close(static_cast <int> (descriptor));
+        delete socket;
+        return nullptr;
+    }
+
+    timer.start();
+
+    QObject::connect(socket, &QSslSocket::encrypted, [socket, timer] () { socket->setProperty("handshake", true); handshakeTime->observe(timer.nsecsElapsed() / 1000); handshakesDone->increment(); });
+    QObject::connect(socket, &QSslSocket::disconnected, [socket] () { if (!socket->property("handshake").toBool()) handshakesFailed->increment(); });
+
+    socket->setSslConfiguration(configuration);
+    socket->startServerEncryption();
+
+    return socket;
+}
+
+void TlsServer::incomingConnection(qintptr descriptor)
+{
+    QSslSocket *socket;
+
+    if (m_configuration.isNull())
+    {
+        QTcpServer::incomingConnection(descriptor);
+        return;
+    }
+
+    socket = TLS::socket(descriptor, m_configuration);
+
+    if (!socket)
+        return;
+
+    addPendingConnection(socket);
+}
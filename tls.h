@@ -0,0 +1,36 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include <QSslConfiguration>
+#include <QSslSocket>
+#include <QTcpServer>
+#include "metrics.h"
+
+namespace TLS
+{
+    QSslConfiguration configuration(const QString &certificate, const QString &key);
+    QSslSocket *socket(qintptr descriptor, const QSslConfiguration &configuration);
+}
+
+class TlsServer : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+
+    TlsServer(QObject *parent = nullptr) : QTcpServer(parent) {}
+
+    inline bool secure(void) { return !m_configuration.isNull(); }
+    inline void setSslConfiguration(const QSslConfiguration &value) { m_configuration = value; }
+
+protected:
+
+    void incomingConnection(qintptr descriptor) override;
+
+private:
+
+    QSslConfiguration m_configuration;
+
+};
+
+#endif
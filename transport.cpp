@@ -0,0 +1,392 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <QElapsedTimer>
+#include <QPointer>
+#include <QThreadStorage>
+#include "transport.h"
+
+static QThreadStorage <EpollLoop*> loops;
+
+Transport *Transport::create(qintptr descriptor, bool native)
+{
+    QTcpSocket *socket;
+
+    if (native)
+        return new EpollTransport(static_cast <int> (descriptor));
+
+    socket = new QTcpSocket;
+
+    if (!socket->setSocketDescriptor(descriptor))
+    {
+        qWarning() << "Socket descriptor" << descriptor << "setup failed:" << socket->errorString();
+        ::close(static_cast <int> (descriptor));
+        delete socket;
+        return nullptr;
+    }
+
+    return new SocketTransport(socket);
+}
+
+SocketTransport::SocketTransport(QTcpSocket *socket, QObject *parent) : Transport(parent), m_socket(socket)
+{
+    m_socket->setParent(this);
+
+    connect(m_socket, &QTcpSocket::readyRead, this, &SocketTransport::readyRead);
+    connect(m_socket, &QTcpSocket::bytesWritten, this, &SocketTransport::bytesWritten);
+    connect(m_socket, &QTcpSocket::disconnected, this, &SocketTransport::disconnected);
+}
+
+void SocketTransport::flush(int timeout)
+{
+    m_socket->flush();
+
+    if (!m_socket->bytesToWrite())
+        return;
+
+    m_socket->waitForBytesWritten(timeout);
+}
+
+EpollLoop::EpollLoop(void) : QObject(nullptr), m_descriptor(epoll_create1(EPOLL_CLOEXEC)), m_index(0), m_count(0), m_notifier(nullptr)
+{
+    if (m_descriptor < 0)
+    {
+        qWarning() << "Epoll instance creation failed:" << strerror(errno);
+        return;
+    }
+
+    m_buffer.resize(EPOLL_BUFFER_SIZE);
+    m_notifier = new QSocketNotifier(m_descriptor, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &EpollLoop::activated);
+}
+
+EpollLoop::~EpollLoop(void)
+{
+    if (m_descriptor < 0)
+        return;
+
+    delete m_notifier;
+    ::close(m_descriptor);
+}
+
+EpollLoop *EpollLoop::instance(void)
+{
+    if (!loops.hasLocalData())
+        loops.setLocalData(new EpollLoop);
+
+    return loops.localData();
+}
+
+bool EpollLoop::add(EpollTransport *transport)
+{
+    epoll_event event;
+
+    if (m_descriptor < 0)
+        return false;
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = transport;
+
+    return !epoll_ctl(m_descriptor, EPOLL_CTL_ADD, transport->descriptor(), &event);
+}
+
+void EpollLoop::remove(EpollTransport *transport)
+{
+    epoll_ctl(m_descriptor, EPOLL_CTL_DEL, transport->descriptor(), nullptr);
+
+    for (int i = m_index; i < m_count; i++)
+    {
+        if (m_events[i].data.ptr != transport)
+            continue;
+
+        m_events[i].data.ptr = nullptr;
+    }
+}
+
+void EpollLoop::activated(void)
+{
+    m_count = epoll_wait(m_descriptor, m_events, EPOLL_BATCH_SIZE, 0);
+
+    for (m_index = 0; m_index < m_count; m_index++)
+    {
+        EpollTransport *transport = reinterpret_cast <EpollTransport*> (m_events[m_index].data.ptr);
+
+        if (!transport)
+            continue;
+
+        transport->process(m_events[m_index].events);
+    }
+
+    m_index = 0;
+    m_count = 0;
+}
+
+EpollTransport::EpollTransport(int descriptor, QObject *parent) : Transport(parent), m_descriptor(descriptor), m_loop(nullptr), m_error(QAbstractSocket::UnknownSocketError), m_pending(0), m_offset(0), m_closing(false), m_hangup(false)
+{
+    int flags = fcntl(m_descriptor, F_GETFL);
+    fcntl(m_descriptor, F_SETFL, flags | O_NONBLOCK);
+    resume();
+}
+
+EpollTransport::~EpollTransport(void)
+{
+    if (m_descriptor < 0)
+        return;
+
+    suspend();
+    ::close(m_descriptor);
+}
+
+QByteArray EpollTransport::read(void)
+{
+    QByteArray data;
+
+    if (m_descriptor < 0)
+        return data;
+
+    while (true)
+    {
+        QByteArray &buffer = EpollLoop::instance()->buffer();
+        ssize_t length = recv(m_descriptor, buffer.data(), static_cast <size_t> (buffer.length()), 0);
+
+        if (length > 0)
+        {
+            data.append(buffer.constData(), static_cast <int> (length));
+            continue;
+        }
+
+        if (length < 0 && errno == EINTR)
+            continue;
+
+        if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+
+        m_error = !length || errno == ECONNRESET ? QAbstractSocket::RemoteHostClosedError : QAbstractSocket::NetworkError;
+
+        if (!data.isEmpty())
+        {
+            m_hangup = true;
+            break;
+        }
+
+        fail(m_error);
+        break;
+    }
+
+    return data;
+}
+
+void EpollTransport::write(const QByteArray &data)
+{
+    if (m_descriptor < 0 || m_closing || data.isEmpty())
+        return;
+
+    m_output.append(data);
+    m_pending += data.length();
+
+    if (m_output.count() > 1)
+        return;
+
+    send();
+}
+
+void EpollTransport::flush(int timeout)
+{
+    QElapsedTimer timer;
+
+    timer.start();
+
+    while (m_descriptor >= 0 && m_pending && timer.elapsed() < timeout)
+    {
+        pollfd item = {m_descriptor, POLLOUT, 0};
+
+        if (poll(&item, 1, static_cast <int> (timeout - timer.elapsed())) <= 0)
+            break;
+
+        send();
+    }
+}
+
+void EpollTransport::suspend(void)
+{
+    if (!m_loop)
+        return;
+
+    m_loop->remove(this);
+    m_loop = nullptr;
+}
+
+void EpollTransport::resume(void)
+{
+    EpollLoop *loop = EpollLoop::instance();
+
+    if (m_descriptor < 0 || m_loop == loop)
+        return;
+
+    suspend();
+
+    if (!loop->add(this))
+    {
+        qWarning() << "Epoll registration for descriptor" << m_descriptor << "failed:" << strerror(errno);
+        return;
+    }
+
+    m_loop = loop;
+}
+
+void EpollTransport::close(void)
+{
+    if (m_descriptor < 0)
+        return;
+
+    if (m_pending)
+    {
+        m_closing = true;
+        return;
+    }
+
+    abort();
+}
+
+void EpollTransport::abort(void)
+{
+    if (m_descriptor < 0)
+        return;
+
+    suspend();
+    ::close(m_descriptor);
+
+    m_descriptor = -1;
+    m_output.clear();
+    m_pending = 0;
+    m_offset = 0;
+
+    emit disconnected();
+}
+
+void EpollTransport::process(quint32 events)
+{
+    QPointer <EpollTransport> pointer = this;
+
+    if (events & EPOLLOUT && m_pending)
+    {
+        qint64 pending = m_pending;
+
+        if (!send())
+            return;
+
+        if (pending > m_pending)
+            emit bytesWritten(pending - m_pending);
+
+        if (m_descriptor < 0)
+            return;
+    }
+
+    if (!(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+        return;
+
+    emit readyRead();
+
+    if (!pointer || m_descriptor < 0 || !(m_hangup || events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+        return;
+
+    fail(m_hangup ? m_error : events & EPOLLERR ? QAbstractSocket::NetworkError : QAbstractSocket::RemoteHostClosedError);
+}
+
+bool EpollTransport::send(void)
+{
+    while (m_pending)
+    {
+        iovec vector[EPOLL_WRITE_VECTORS];
+        msghdr message;
+        int count = qMin(m_output.count(), EPOLL_WRITE_VECTORS);
+        ssize_t length;
+
+        for (int i = 0; i < count; i++)
+        {
+            const QByteArray &data = m_output.at(i);
+            int offset = i ? 0 : m_offset;
+
+            vector[i].iov_base = const_cast <char*> (data.constData() + offset);
+            vector[i].iov_len = static_cast <size_t> (data.length() - offset);
+        }
+
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = vector;
+        message.msg_iovlen = static_cast <size_t> (count);
+
+        length = sendmsg(m_descriptor, &message, MSG_NOSIGNAL);
+
+        if (length < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+
+            fail(errno == EPIPE || errno == ECONNRESET ? QAbstractSocket::RemoteHostClosedError : QAbstractSocket::NetworkError);
+            return false;
+        }
+
+        m_pending -= length;
+
+        while (length)
+        {
+            qint64 left = m_output.first().length() - m_offset;
+
+            if (length < left)
+            {
+                m_offset += static_cast <int> (length);
+                break;
+            }
+
+            m_output.removeFirst();
+            m_offset = 0;
+            length -= left;
+        }
+    }
+
+    if (m_closing)
+    {
+        abort();
+        return false;
+    }
+
+    return true;
+}
+
+void EpollTransport::fail(QAbstractSocket::SocketError error)
+{
+    m_error = error;
+    abort();
+}
+
+Transport *TransportServer::nextTransport(void)
+{
+    return m_transports.isEmpty() ? nullptr : m_transports.takeFirst();
+}
+
+void TransportServer::incomingConnection(qintptr descriptor)
+{
+    Transport *transport;
+
+    if (!m_configuration.isNull())
+    {
+        QSslSocket *socket = TLS::socket(descriptor, m_configuration);
+        transport = socket ? new SocketTransport(socket) : nullptr;
+    }
+    else
+        transport = Transport::create(descriptor, m_native);
+
+    if (!transport)
+        return;
+
+    transport->setParent(this);
+    m_transports.append(transport);
+}
@@ -0,0 +1,175 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#define EPOLL_BATCH_SIZE        256
+#define EPOLL_BUFFER_SIZE       65536
+#define EPOLL_WRITE_VECTORS     64
+
+#include <sys/epoll.h>
+#include <QSocketNotifier>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include "tls.h"
+
+class Transport : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    Transport(QObject *parent = nullptr) : QObject(parent) {}
+    virtual ~Transport(void) {}
+
+    static Transport *create(qintptr descriptor, bool native);
+
+    virtual int descriptor(void) = 0;
+    virtual bool connected(void) = 0;
+    virtual QAbstractSocket::SocketError error(void) = 0;
+    virtual qint64 bytesToWrite(void) = 0;
+    virtual bool secure(void) { return false; }
+
+    virtual QByteArray read(void) = 0;
+    virtual void write(const QByteArray &data) = 0;
+    virtual void flush(int timeout) = 0;
+
+    virtual void suspend(void) {}
+    virtual void resume(void) {}
+
+    virtual void close(void) = 0;
+    virtual void abort(void) = 0;
+
+signals:
+
+    void readyRead(void);
+    void bytesWritten(qint64 bytes);
+    void disconnected(void);
+
+};
+
+class SocketTransport : public Transport
+{
+    Q_OBJECT
+
+public:
+
+    SocketTransport(QTcpSocket *socket, QObject *parent = nullptr);
+
+    inline int descriptor(void) override { return static_cast <int> (m_socket->socketDescriptor()); }
+    inline bool connected(void) override { return m_socket->state() == QAbstractSocket::ConnectedState; }
+    inline QAbstractSocket::SocketError error(void) override { return m_socket->error(); }
+    inline qint64 bytesToWrite(void) override { return m_socket->bytesToWrite(); }
+    inline bool secure(void) override { return m_socket->inherits("QSslSocket"); }
+
+    inline QByteArray read(void) override { return m_socket->readAll(); }
+    inline void write(const QByteArray &data) override { m_socket->write(data); }
+    void flush(int timeout) override;
+
+    inline void close(void) override { m_socket->close(); }
+    inline void abort(void) override { m_socket->abort(); }
+
+private:
+
+    QTcpSocket *m_socket;
+
+};
+
+class EpollTransport;
+
+class EpollLoop : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    EpollLoop(void);
+    ~EpollLoop(void);
+
+    static EpollLoop *instance(void);
+
+    inline QByteArray &buffer(void) { return m_buffer; }
+
+    bool add(EpollTransport *transport);
+    void remove(EpollTransport *transport);
+
+private:
+
+    int m_descriptor, m_index, m_count;
+    QSocketNotifier *m_notifier;
+
+    epoll_event m_events[EPOLL_BATCH_SIZE];
+    QByteArray m_buffer;
+
+private slots:
+
+    void activated(void);
+
+};
+
+class EpollTransport : public Transport
+{
+    Q_OBJECT
+
+public:
+
+    EpollTransport(int descriptor, QObject *parent = nullptr);
+    ~EpollTransport(void);
+
+    inline int descriptor(void) override { return m_descriptor; }
+    inline bool connected(void) override { return m_descriptor >= 0; }
+    inline QAbstractSocket::SocketError error(void) override { return m_error; }
+    inline qint64 bytesToWrite(void) override { return m_pending; }
+
+    QByteArray read(void) override;
+    void write(const QByteArray &data) override;
+    void flush(int timeout) override;
+
+    void suspend(void) override;
+    void resume(void) override;
+
+    void close(void) override;
+    void abort(void) override;
+
+    void process(quint32 events);
+
+private:
+
+    int m_descriptor;
+    EpollLoop *m_loop;
+    QAbstractSocket::SocketError m_error;
+
+    QList <QByteArray> m_output;
+    qint64 m_pending;
+    int m_offset;
+    bool m_closing, m_hangup;
+
+    bool send(void);
+    void fail(QAbstractSocket::SocketError error);
+
+};
+
+class TransportServer : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+
+    TransportServer(bool native, QObject *parent = nullptr) : QTcpServer(parent), m_native(native) {}
+
+    inline bool native(void) { return m_native; }
+    inline void setSslConfiguration(const QSslConfiguration &value) { m_configuration = value; }
+
+    Transport *nextTransport(void);
+
+protected:
+
+    void incomingConnection(qintptr descriptor) override;
+
+private:
+
+    bool m_native;
+    QSslConfiguration m_configuration;
+    QList <Transport*> m_transports;
+
+};
+
+#endif
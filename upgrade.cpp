@@ -0,0 +1,241 @@
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <QLocalSocket>
+#include "upgrade.h"
+
+Upgrade::Upgrade(const QString &path, QObject *parent) : QObject(parent), m_server(new QLocalServer(this)), m_path(path), m_socket(-1)
+{
+    m_server->setSocketOptions(QLocalServer::UserAccessOption);
+    connect(m_server, &QLocalServer::newConnection, this, &Upgrade::newConnection);
+}
+
+Upgrade::~Upgrade(void)
+{
+    for (auto it = m_descriptors.begin(); it != m_descriptors.end(); it++)
+        ::close(it.value());
+
+    if (m_socket >= 0)
+        ::close(m_socket);
+}
+
+bool Upgrade::receive(void)
+{
+    timeval timeout = {UPGRADE_TIMEOUT / 1000, 0};
+    sockaddr_un address;
+    QJsonObject json;
+    int descriptor;
+
+    if (!enabled() || m_path.toUtf8().length() >= static_cast <int> (sizeof(address.sun_path)))
+        return false;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, m_path.toUtf8().constData());
+
+    m_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    if (::connect(m_socket, reinterpret_cast <sockaddr*> (&address), sizeof(address)) < 0)
+    {
+        ::close(m_socket);
+        m_socket = -1;
+        return false;
+    }
+
+    qDebug() << "Taking over connections from the running process";
+
+    while (receiveMessage(json, descriptor))
+    {
+        QString type = json.value("type").toString();
+
+        if (type == "end")
+        {
+            qDebug() << "Connection handoff finished," << m_descriptors.count() << "listeners and" << m_clients.count() << "hub connections received";
+            ::close(m_socket);
+            m_socket = -1;
+            return true;
+        }
+
+        if (descriptor < 0)
+            continue;
+
+        if (type == "listener")
+            m_descriptors.insert(json.value("name").toString(), descriptor);
+        else if (type == "client")
+            m_clients.append({descriptor, json.value("state").toObject()});
+        else
+            ::close(descriptor);
+    }
+
+    qWarning() << "Connection handoff interrupted," << m_clients.count() << "hub connections received";
+    ::close(m_socket);
+    m_socket = -1;
+
+    return !m_descriptors.isEmpty() || !m_clients.isEmpty();
+}
+
+bool Upgrade::send(const QMap <QString, int> &listeners, const QList <Handoff> &clients)
+{
+    bool result = m_socket >= 0;
+
+    for (auto it = listeners.begin(); result && it != listeners.end(); it++)
+        result = sendMessage({{"type", "listener"}, {"name", it.key()}}, it.value());
+
+    for (int i = 0; i < clients.count(); i++)
+    {
+        if (result)
+            result = sendMessage({{"type", "client"}, {"state", clients.at(i).state}}, clients.at(i).descriptor);
+
+        ::close(clients.at(i).descriptor);
+    }
+
+    if (result)
+        result = sendMessage({{"type", "end"}});
+
+    if (m_socket >= 0)
+    {
+        ::close(m_socket);
+        m_socket = -1;
+    }
+
+    return result;
+}
+
+int Upgrade::descriptor(const QString &name)
+{
+    return m_descriptors.contains(name) ? m_descriptors.take(name) : -1;
+}
+
+void Upgrade::listen(void)
+{
+    if (!enabled())
+        return;
+
+    QLocalServer::removeServer(m_path);
+
+    if (m_server->listen(m_path))
+        return;
+
+    qWarning() << "Upgrade socket startup error:" << m_server->errorString();
+}
+
+bool Upgrade::sendMessage(const QJsonObject &json, int descriptor)
+{
+    QByteArray data = QJsonDocument(json).toJson(QJsonDocument::Compact);
+    quint32 length = static_cast <quint32> (data.length());
+    char control[CMSG_SPACE(sizeof(int))];
+    iovec vector = {&length, sizeof(length)};
+    msghdr message;
+    int offset = 0;
+
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+
+    if (descriptor >= 0)
+    {
+        cmsghdr *header;
+
+        memset(control, 0, sizeof(control));
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(header), &descriptor, sizeof(int));
+    }
+
+    if (sendmsg(m_socket, &message, MSG_NOSIGNAL) != sizeof(length))
+        return false;
+
+    while (offset < data.length())
+    {
+        ssize_t result = ::send(m_socket, data.constData() + offset, data.length() - offset, MSG_NOSIGNAL);
+
+        if (result <= 0)
+            return false;
+
+        offset += result;
+    }
+
+    return true;
+}
+
+bool Upgrade::receiveMessage(QJsonObject &json, int &descriptor)
+{
+    char control[CMSG_SPACE(sizeof(int))];
+    quint32 length = 0;
+    iovec vector = {&length, sizeof(length)};
+    msghdr message;
+    cmsghdr *header;
+    QByteArray data;
+    ssize_t result;
+    quint32 offset = 0;
+
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    descriptor = -1;
+    result = recvmsg(m_socket, &message, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+    header = CMSG_FIRSTHDR(&message);
+
+    if (result > 0 && header && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+        memcpy(&descriptor, CMSG_DATA(header), sizeof(int));
+
+    if (result != sizeof(length) || length > UPGRADE_MESSAGE_LIMIT)
+    {
+        if (descriptor >= 0)
+            ::close(descriptor);
+
+        return false;
+    }
+
+    data.resize(static_cast <int> (length));
+
+    while (offset < length)
+    {
+        result = recv(m_socket, data.data() + offset, length - offset, 0);
+
+        if (result <= 0)
+        {
+            if (descriptor >= 0)
+                ::close(descriptor);
+
+            return false;
+        }
+
+        offset += static_cast <quint32> (result);
+    }
+
+    json = QJsonDocument::fromJson(data).object();
+    return true;
+}
+
+void Upgrade::newConnection(void)
+{
+    QLocalSocket *socket = m_server->nextPendingConnection();
+    timeval timeout = {UPGRADE_TIMEOUT / 1000, 0};
+
+    if (!socket)
+        return;
+
+    m_socket = dup(static_cast <int> (socket->socketDescriptor()));
+    socket->abort();
+    socket->deleteLater();
+
+    if (m_socket < 0)
+        return;
+
+    fcntl(m_socket, F_SETFL, fcntl(m_socket, F_GETFL) & ~O_NONBLOCK);
+    setsockopt(m_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    m_server->close();
+    emit requested();
+}
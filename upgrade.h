@@ -0,0 +1,58 @@
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#define UPGRADE_TIMEOUT         10000
+#define UPGRADE_MESSAGE_LIMIT   (64 * 1024 * 1024)
+
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalServer>
+#include <QMap>
+
+struct Handoff
+{
+    int descriptor;
+    QJsonObject state;
+};
+
+class Upgrade : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    Upgrade(const QString &path, QObject *parent = nullptr);
+    ~Upgrade(void);
+
+    inline bool enabled(void) { return !m_path.isEmpty(); }
+    inline QList <Handoff> &clients(void) { return m_clients; }
+
+    bool receive(void);
+    bool send(const QMap <QString, int> &listeners, const QList <Handoff> &clients);
+
+    int descriptor(const QString &name);
+    void listen(void);
+
+private:
+
+    QLocalServer *m_server;
+    QString m_path;
+    int m_socket;
+
+    QMap <QString, int> m_descriptors;
+    QList <Handoff> m_clients;
+
+    bool sendMessage(const QJsonObject &json, int descriptor = -1);
+    bool receiveMessage(QJsonObject &json, int &descriptor);
+
+private slots:
+
+    void newConnection(void);
+
+signals:
+
+    void requested(void);
+
+};
+
+#endif
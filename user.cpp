@@ -0,0 +1,233 @@
+#include "user.h"
+
+Token::Token(const QByteArray &value)
+{
+    memset(m_data, 0, sizeof(m_data));
+    memcpy(m_data, value.constData(), qMin(static_cast <size_t> (value.length()), sizeof(m_data)));
+}
+
+bool Token::isEmpty(void) const
+{
+    for (size_t i = 0; i < sizeof(m_data); i++)
+        if (m_data[i])
+            return false;
+
+    return true;
+}
+
+QByteArray Token::toByteArray(void) const
+{
+    return isEmpty() ? QByteArray() : QByteArray(reinterpret_cast <const char*> (m_data), sizeof(m_data));
+}
+
+UserData *Users::find(qint64 chat)
+{
+    auto it = m_chatIndex.find(chat);
+    return it != m_chatIndex.end() ? &m_list[it.value()] : nullptr;
+}
+
+UserData *Users::findByName(const QByteArray &name)
+{
+    for (int i = 0; i < m_list.count(); i++)
+    {
+        UserData &user = m_list[i];
+
+        if (user.nameLength != name.length() || memcmp(m_names.constData() + user.nameOffset, name.constData(), user.nameLength))
+            continue;
+
+        return &user;
+    }
+
+    return nullptr;
+}
+
+UserData *Users::findByClientToken(const QByteArray &token)
+{
+    return findToken(m_clientIndex, &UserData::clientToken, token);
+}
+
+UserData *Users::findByAccessToken(const QByteArray &token)
+{
+    return findToken(m_accessIndex, &UserData::accessToken, token);
+}
+
+UserData *Users::findByRefreshToken(const QByteArray &token)
+{
+    return findToken(m_refreshIndex, &UserData::refreshToken, token);
+}
+
+UserData *Users::insert(qint64 chat)
+{
+    UserData *user = find(chat);
+
+    if (user)
+        return user;
+
+    m_list.append({chat, 0, 0, 0, BotStatus::Idle, Token(), Token(), Token(), Token()});
+    m_chatIndex.insert(chat, static_cast <quint32> (m_list.count() - 1));
+
+    return &m_list.last();
+}
+
+void Users::remove(qint64 chat)
+{
+    auto it = m_chatIndex.find(chat);
+    quint32 position, last;
+
+    if (it == m_chatIndex.end())
+        return;
+
+    position = it.value();
+    last = static_cast <quint32> (m_list.count() - 1);
+    m_garbage += m_list.at(position).nameLength;
+
+    removeIndex(position);
+    m_chatIndex.erase(it);
+
+    if (position != last)
+    {
+        removeIndex(last);
+        m_list[position] = m_list.at(last);
+        m_chatIndex.insert(m_list.at(position).chat, position);
+        addIndex(position);
+    }
+
+    m_list.removeLast();
+    compactNames();
+}
+
+QByteArray Users::name(UserData *user)
+{
+    return m_names.mid(user->nameOffset, user->nameLength);
+}
+
+bool Users::setName(UserData *user, const QByteArray &value)
+{
+    if (value.length() > NAME_LIMIT)
+        return false;
+
+    if (value.length() <= user->nameLength)
+    {
+        memcpy(m_names.data() + user->nameOffset, value.constData(), value.length());
+        m_garbage += user->nameLength - value.length();
+        user->nameLength = static_cast <quint8> (value.length());
+    }
+    else
+    {
+        m_garbage += user->nameLength;
+        user->nameOffset = static_cast <quint32> (m_names.length());
+        user->nameLength = static_cast <quint8> (value.length());
+        m_names.append(value);
+    }
+
+    compactNames();
+    return true;
+}
+
+QByteArray Users::hash(UserData *user)
+{
+    return user->hash.toByteArray().toHex();
+}
+
+void Users::setHash(UserData *user, const QByteArray &value)
+{
+    user->hash = Token(QByteArray::fromHex(value));
+}
+
+void Users::setClientToken(UserData *user, const QByteArray &value)
+{
+    updateToken(m_clientIndex, &UserData::clientToken, user, Token(value));
+}
+
+void Users::setAccessToken(UserData *user, const QByteArray &value)
+{
+    updateToken(m_accessIndex, &UserData::accessToken, user, Token(value));
+}
+
+void Users::setRefreshToken(UserData *user, const QByteArray &value)
+{
+    updateToken(m_refreshIndex, &UserData::refreshToken, user, Token(value));
+}
+
+UserData *Users::findToken(const QMultiHash <quint64, quint32> &index, Token UserData::*member, const QByteArray &value)
+{
+    Token token(value);
+
+    if (token.isEmpty())
+        return nullptr;
+
+    for (auto it = index.find(token.key()); it != index.end() && it.key() == token.key(); it++)
+    {
+        UserData &user = m_list[it.value()];
+
+        if (user.*member == token)
+            return &user;
+    }
+
+    return nullptr;
+}
+
+void Users::updateToken(QMultiHash <quint64, quint32> &index, Token UserData::*member, UserData *user, const Token &token)
+{
+    quint32 position = static_cast <quint32> (user - m_list.data());
+
+    if (!(user->*member).isEmpty())
+        index.remove((user->*member).key(), position);
+
+    user->*member = token;
+
+    if (token.isEmpty())
+        return;
+
+    index.insert(token.key(), position);
+}
+
+void Users::compactNames(void)
+{
+    QByteArray names;
+
+    if (m_garbage <= NAME_GARBAGE || m_garbage <= static_cast <quint32> (m_names.length()) / 2)
+        return;
+
+    names.reserve(m_names.length() - m_garbage);
+
+    for (int i = 0; i < m_list.count(); i++)
+    {
+        UserData &user = m_list[i];
+        quint32 offset = static_cast <quint32> (names.length());
+
+        names.append(m_names.constData() + user.nameOffset, user.nameLength);
+        user.nameOffset = offset;
+    }
+
+    m_names = names;
+    m_garbage = 0;
+}
+
+void Users::addIndex(quint32 position)
+{
+    const UserData &user = m_list.at(position);
+
+    if (!user.clientToken.isEmpty())
+        m_clientIndex.insert(user.clientToken.key(), position);
+
+    if (!user.accessToken.isEmpty())
+        m_accessIndex.insert(user.accessToken.key(), position);
+
+    if (!user.refreshToken.isEmpty())
+        m_refreshIndex.insert(user.refreshToken.key(), position);
+}
+
+void Users::removeIndex(quint32 position)
+{
+    const UserData &user = m_list.at(position);
+
+    if (!user.clientToken.isEmpty())
+        m_clientIndex.remove(user.clientToken.key(), position);
+
+    if (!user.accessToken.isEmpty())
+        m_accessIndex.remove(user.accessToken.key(), position);
+
+    if (!user.refreshToken.isEmpty())
+        m_refreshIndex.remove(user.refreshToken.key(), position);
+}
@@ -0,0 +1,128 @@
+#ifndef USER_H
+#define USER_H
+
+#define TOKEN_LENGTH    32
+#define NAME_LIMIT      255
+#define NAME_GARBAGE    (64 * 1024)
+
+#include <QHash>
+#include <QVector>
+#include "client.h"
+#include "compress.h"
+
+enum class BotStatus : quint8
+{
+    Idle,
+    Remove,
+    Renew
+};
+
+class Token
+{
+
+public:
+
+    Token(void) { memset(m_data, 0, sizeof(m_data)); }
+    Token(const QByteArray &value);
+
+    inline quint64 key(void) const { quint64 value; memcpy(&value, m_data, sizeof(value)); return value; }
+    inline bool operator == (const Token &other) const { return !memcmp(m_data, other.m_data, sizeof(m_data)); }
+
+    bool isEmpty(void) const;
+    QByteArray toByteArray(void) const;
+
+private:
+
+    quint8 m_data[TOKEN_LENGTH];
+
+};
+
+struct UserData
+{
+    qint64 chat, tokenExpire;
+    quint32 nameOffset;
+    quint8 nameLength;
+    BotStatus botStatus;
+    Token hash, clientToken, accessToken, refreshToken;
+};
+
+struct Discovery
+{
+    QByteArray name, prefix;
+    QMap <QString, quint64> revisions;
+    Compressed compressed;
+};
+
+class UserObject : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    UserObject(qint64 chat, const QByteArray &name) : QObject(nullptr), m_chat(chat), m_name(name) {}
+
+    inline qint64 chat(void) { return m_chat; }
+
+    inline QByteArray name(void) { return m_name; }
+    inline void setName(const QByteArray &value) { m_name = value; }
+
+    inline QMap <QString, Client*> &clients(void) { return m_clients; }
+    inline Discovery &discovery(void) { return m_discovery; }
+
+private:
+
+    qint64 m_chat;
+    QByteArray m_name;
+    QMap <QString, Client*> m_clients;
+    Discovery m_discovery;
+
+};
+
+class Users
+{
+
+public:
+
+    Users(void) : m_garbage(0) {}
+
+    inline int count(void) { return m_list.count(); }
+
+    UserData *find(qint64 chat);
+    UserData *findByName(const QByteArray &name);
+    UserData *findByClientToken(const QByteArray &token);
+    UserData *findByAccessToken(const QByteArray &token);
+    UserData *findByRefreshToken(const QByteArray &token);
+
+    UserData *insert(qint64 chat);
+    void remove(qint64 chat);
+
+    QByteArray name(UserData *user);
+    bool setName(UserData *user, const QByteArray &value);
+
+    QByteArray hash(UserData *user);
+    void setHash(UserData *user, const QByteArray &value);
+
+    void setClientToken(UserData *user, const QByteArray &value);
+    void setAccessToken(UserData *user, const QByteArray &value);
+    void setRefreshToken(UserData *user, const QByteArray &value);
+
+private:
+
+    QVector <UserData> m_list;
+    QByteArray m_names;
+    quint32 m_garbage;
+
+    QHash <qint64, quint32> m_chatIndex;
+    QMultiHash <quint64, quint32> m_clientIndex, m_accessIndex, m_refreshIndex;
+
+    UserData *findToken(const QMultiHash <quint64, quint32> &index, Token UserData::*member, const QByteArray &value);
+    void updateToken(QMultiHash <quint64, quint32> &index, Token UserData::*member, UserData *user, const Token &token);
+
+    void compactNames(void);
+
+    void addIndex(quint32 position);
+    void removeIndex(quint32 position);
+
+};
+
+#endif
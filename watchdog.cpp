@@ -0,0 +1,138 @@
+#include <QCoreApplication>
+#include <QEvent>
+#include <QMetaEnum>
+#include "watchdog.h"
+
+QAtomicInt Watchdog::s_level;
+
+Watchdog::Watchdog(int shed, int pause, int stall, QObject *parent) : QObject(parent), m_thread(new QThread), m_shed(shed), m_pause(pause), m_stall(stall), m_levelGauge(Metrics::instance()->gauge("load_shedding_level")), m_event(0)
+{
+    m_clock.start();
+    m_thread->setObjectName("watchdog");
+
+    connect(m_thread, &QThread::started, [this] ()
+    {
+        QTimer *timer = new QTimer;
+        connect(timer, &QTimer::timeout, [this] () { check(); });
+        connect(m_thread, &QThread::finished, timer, &QTimer::deleteLater);
+        timer->start(WATCHDOG_INTERVAL);
+    });
+
+    if (!QCoreApplication::instance())
+        return;
+
+    QCoreApplication::instance()->installEventFilter(this);
+}
+
+Watchdog::~Watchdog(void)
+{
+    m_thread->quit();
+    m_thread->wait();
+
+    delete m_thread;
+    qDeleteAll(m_loops);
+}
+
+void Watchdog::watch(QObject *context, const QString &name)
+{
+    Loop *loop = new Loop;
+
+    loop->name = name;
+    loop->heartbeat.storeRelaxed(-1);
+    loop->lag.storeRelaxed(0);
+    loop->histogram = Metrics::instance()->histogram("event_loop_lag_seconds", QString("loop=\"%1\"").arg(name));
+    loop->stalls = Metrics::instance()->counter("event_loop_stalls_total", QString("loop=\"%1\"").arg(name));
+    loop->main = context->thread() == thread();
+    loop->stalled = false;
+
+    m_loops.append(loop);
+
+    QMetaObject::invokeMethod(context, [this, context, loop] ()
+    {
+        QTimer *timer = new QTimer(context);
+        connect(timer, &QTimer::timeout, context, [this, loop] () { tick(loop); });
+        loop->heartbeat.storeRelaxed(m_clock.elapsed());
+        timer->start(WATCHDOG_INTERVAL);
+    });
+}
+
+void Watchdog::start(void)
+{
+    m_thread->start();
+}
+
+void Watchdog::tick(Loop *loop)
+{
+    qint64 now = m_clock.elapsed(), lag = qMax(now - loop->heartbeat.loadRelaxed() - WATCHDOG_INTERVAL, Q_INT64_C(0));
+
+    loop->heartbeat.storeRelaxed(now);
+    loop->lag.storeRelaxed(qMax(lag, loop->lag.loadRelaxed() * 3 / 4));
+    loop->histogram->observe(lag * 1000);
+}
+
+void Watchdog::check(void)
+{
+    Level level = Watchdog::level(), next;
+    qint64 now = m_clock.elapsed(), lag = 0;
+    const QMetaObject *receiver, *parent;
+
+    for (int i = 0; i < m_loops.count(); i++)
+    {
+        Loop *loop = m_loops.at(i);
+        qint64 heartbeat = loop->heartbeat.loadRelaxed(), delay;
+
+        if (heartbeat < 0)
+            continue;
+
+        delay = now - heartbeat - WATCHDOG_INTERVAL;
+        lag = qMax(lag, qMax(delay, loop->lag.loadRelaxed()));
+
+        if (delay < m_stall)
+        {
+            loop->stalled = false;
+            continue;
+        }
+
+        if (loop->stalled)
+            continue;
+
+        loop->stalled = true;
+        loop->stalls->increment();
+
+        if (!loop->main)
+        {
+            qWarning() << "Event loop" << loop->name << "stalled for" << delay << "ms";
+            continue;
+        }
+
+        receiver = m_receiver.loadRelaxed();
+        parent = m_parent.loadRelaxed();
+
+        qWarning() << "Event loop" << loop->name << "stalled for" << delay << "ms in" << (receiver ? receiver->className() : "unknown") << (parent ? parent->className() : "") << QMetaEnum::fromType <QEvent::Type> ().valueToKey(m_event.loadRelaxed());
+    }
+
+    if (m_pause && lag >= m_pause)
+        next = Level::Pause;
+    else if (m_shed && lag >= m_shed)
+        next = level == Level::Pause && lag >= m_pause / 2 ? Level::Pause : Level::Shed;
+    else
+        next = level != Level::Normal && m_shed && lag >= m_shed / 2 ? Level::Shed : Level::Normal;
+
+    if (next == level)
+        return;
+
+    qWarning() << "Load shedding level changed from" << QMetaEnum::fromType <Level> ().valueToKey(static_cast <int> (level)) << "to" << QMetaEnum::fromType <Level> ().valueToKey(static_cast <int> (next)) << "with" << lag << "ms event loop lag";
+
+    s_level.storeRelaxed(static_cast <int> (next));
+    m_levelGauge->set(static_cast <int> (next));
+
+    emit levelChanged(next);
+}
+
+bool Watchdog::eventFilter(QObject *object, QEvent *event)
+{
+    m_receiver.storeRelaxed(object->metaObject());
+    m_parent.storeRelaxed(object->parent() ? object->parent()->metaObject() : nullptr);
+    m_event.storeRelaxed(event->type());
+    return false;
+}
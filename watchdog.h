@@ -0,0 +1,72 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#define WATCHDOG_INTERVAL       100
+#define WATCHDOG_STALL          1000
+#define WATCHDOG_RETRY_AFTER    5
+
+#include <QElapsedTimer>
+#include <QThread>
+#include <QTimer>
+#include "metrics.h"
+
+class Watchdog : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    enum class Level
+    {
+        Normal,
+        Shed,
+        Pause
+    };
+
+    Q_ENUM(Level)
+
+    Watchdog(int shed, int pause, int stall = WATCHDOG_STALL, QObject *parent = nullptr);
+    ~Watchdog(void);
+
+    static inline Level level(void) { return static_cast <Level> (s_level.loadRelaxed()); }
+
+    void watch(QObject *context, const QString &name);
+    void start(void);
+
+private:
+
+    struct Loop
+    {
+        QString name;
+        QAtomicInteger <qint64> heartbeat, lag;
+        Histogram *histogram;
+        Counter *stalls;
+        bool main, stalled;
+    };
+
+    static QAtomicInt s_level;
+
+    QThread *m_thread;
+    QElapsedTimer m_clock;
+    QList <Loop*> m_loops;
+
+    int m_shed, m_pause, m_stall;
+    Gauge *m_levelGauge;
+
+    QAtomicPointer <const QMetaObject> m_receiver, m_parent;
+    QAtomicInt m_event;
+
+    void tick(Loop *loop);
+    void check(void);
+
+protected:
+
+    bool eventFilter(QObject *object, QEvent *event) override;
+
+signals:
+
+    void levelChanged(Watchdog::Level level);
+
+};
+
+#endif
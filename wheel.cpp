@@ -0,0 +1,162 @@
+#include <QThreadStorage>
+#include "wheel.h"
+
+static QThreadStorage <TimerWheel*> wheels;
+static QAtomicInteger <quint64> sequence;
+
+TimerWheel::TimerWheel(void) : QObject(nullptr), m_timer(new QTimer(this)), m_tick(0)
+{
+    m_expiredCounter = Metrics::instance()->counter("timer_wheel_expired_total");
+    m_entryGauge = Metrics::instance()->gauge("timer_wheel_entries");
+
+    for (int i = 0; i < WHEEL_LEVELS; i++)
+    {
+        for (int j = 0; j < WHEEL_SLOTS; j++)
+        {
+            m_slots[i][j].prev = &m_slots[i][j];
+            m_slots[i][j].next = &m_slots[i][j];
+        }
+    }
+
+    connect(m_timer, &QTimer::timeout, this, &TimerWheel::update);
+    m_timer->setTimerType(Qt::CoarseTimer);
+    m_clock.start();
+}
+
+TimerWheel::~TimerWheel(void)
+{
+    m_entryGauge->add(-m_nodes.count());
+    qDeleteAll(m_nodes);
+}
+
+TimerWheel *TimerWheel::instance(void)
+{
+    if (!wheels.hasLocalData())
+        wheels.setLocalData(new TimerWheel);
+
+    return wheels.localData();
+}
+
+quint64 TimerWheel::add(int timeout, const Callback &callback)
+{
+    Node *node = new Node;
+    quint64 now = static_cast <quint64> (m_clock.elapsed() / WHEEL_RESOLUTION), ticks = static_cast <quint64> (qMax((timeout + WHEEL_RESOLUTION - 1) / WHEEL_RESOLUTION, 1));
+
+    if (m_nodes.isEmpty())
+    {
+        m_tick = now;
+        m_timer->start(WHEEL_RESOLUTION);
+    }
+
+    node->id = ++sequence;
+    node->expire = now + qMin(ticks, (Q_UINT64_C(1) << WHEEL_BITS * WHEEL_LEVELS) - 1);
+    node->callback = callback;
+
+    m_nodes.insert(node->id, node);
+    m_entryGauge->add(1);
+
+    insert(node);
+    return node->id;
+}
+
+void TimerWheel::cancel(quint64 id)
+{
+    Node *node = m_nodes.take(id);
+
+    if (!node)
+        return;
+
+    unlink(node);
+    m_entryGauge->add(-1);
+    delete node;
+
+    if (!m_nodes.isEmpty())
+        return;
+
+    m_timer->stop();
+}
+
+void TimerWheel::link(Node *head, Node *node)
+{
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+void TimerWheel::unlink(Node *node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node;
+    node->next = node;
+}
+
+void TimerWheel::insert(Node *node)
+{
+    quint64 delta = node->expire > m_tick ? node->expire - m_tick : 0;
+    int level = 0;
+
+    while (level < WHEEL_LEVELS - 1 && delta >> WHEEL_BITS * (level + 1))
+        level++;
+
+    link(&m_slots[level][node->expire >> WHEEL_BITS * level & (WHEEL_SLOTS - 1)], node);
+}
+
+void TimerWheel::cascade(int level)
+{
+    Node *head = &m_slots[level][m_tick >> WHEEL_BITS * level & (WHEEL_SLOTS - 1)];
+
+    while (head->next != head)
+    {
+        Node *node = head->next;
+        unlink(node);
+        insert(node);
+    }
+}
+
+void TimerWheel::update(void)
+{
+    quint64 target = static_cast <quint64> (m_clock.elapsed() / WHEEL_RESOLUTION);
+
+    while (m_tick < target && !m_nodes.isEmpty())
+    {
+        Node list, *head;
+
+        m_tick++;
+
+        for (int i = 1; i < WHEEL_LEVELS && !(m_tick & ((Q_UINT64_C(1) << WHEEL_BITS * i) - 1)); i++)
+            cascade(i);
+
+        head = &m_slots[0][m_tick & (WHEEL_SLOTS - 1)];
+
+        if (head->next == head)
+            continue;
+
+        list.prev = head->prev;
+        list.next = head->next;
+        list.prev->next = &list;
+        list.next->prev = &list;
+        head->prev = head;
+        head->next = head;
+
+        while (list.next != &list)
+        {
+            Node *node = list.next;
+            Callback callback = std::move(node->callback);
+
+            unlink(node);
+            m_nodes.remove(node->id);
+            m_entryGauge->add(-1);
+            m_expiredCounter->increment();
+            delete node;
+
+            callback();
+        }
+    }
+
+    if (!m_nodes.isEmpty())
+        return;
+
+    m_timer->stop();
+}
@@ -0,0 +1,64 @@
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#define WHEEL_RESOLUTION        100
+#define WHEEL_LEVELS            4
+#define WHEEL_BITS              6
+#define WHEEL_SLOTS             (1 << WHEEL_BITS)
+
+#include <functional>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QTimer>
+#include "metrics.h"
+
+class TimerWheel : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    typedef std::function <void (void)> Callback;
+
+    TimerWheel(void);
+    ~TimerWheel(void);
+
+    static TimerWheel *instance(void);
+
+    quint64 add(int timeout, const Callback &callback);
+    void cancel(quint64 id);
+
+    inline int count(void) { return m_nodes.count(); }
+
+private:
+
+    struct Node
+    {
+        Node *prev, *next;
+        quint64 id, expire;
+        Callback callback;
+    };
+
+    QTimer *m_timer;
+    QElapsedTimer m_clock;
+
+    Node m_slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    QHash <quint64, Node*> m_nodes;
+    quint64 m_tick;
+
+    Counter *m_expiredCounter;
+    Gauge *m_entryGauge;
+
+    void link(Node *head, Node *node);
+    void unlink(Node *node);
+
+    void insert(Node *node);
+    void cascade(int level);
+
+private slots:
+
+    void update(void);
+
+};
+
+#endif
@@ -0,0 +1,374 @@
+#include <unistd.h>
+#include <QDateTime>
+#include "worker.h"
+
+TaskQueue::TaskQueue(void) : m_tail(new Node)
+{
+    m_head.storeRelaxed(m_tail);
+}
+
+TaskQueue::~TaskQueue(void)
+{
+    Task task;
+
+    while (pop(task));
+    delete m_tail;
+}
+
+void TaskQueue::push(const Task &task)
+{
+    Node *node = new Node;
+
+    node->task = task;
+    m_head.fetchAndStoreOrdered(node)->next.storeRelease(node);
+}
+
+bool TaskQueue::pop(Task &task)
+{
+    Node *next = m_tail->next.loadAcquire();
+
+    if (!next)
+        return false;
+
+    delete m_tail;
+
+    task = std::move(next->task);
+    next->task = nullptr;
+    m_tail = next;
+
+    return true;
+}
+
+Worker::Worker(int index, const QByteArray &skillId, const QByteArray &skillToken, bool debug) : QObject(nullptr), m_thread(new QThread), m_timer(nullptr), m_index(index), m_skillId(skillId), m_skillToken(skillToken), m_debug(debug)
+{
+    Metrics *metrics = Metrics::instance();
+
+    m_discoveryCounter = metrics->counter("callbacks_total", "type=\"discovery\"");
+    m_deferredCounter = metrics->counter("callbacks_deferred_total", "type=\"discovery\"");
+    m_stateCounter = metrics->counter("callbacks_total", "type=\"state\"");
+    m_taskCounter = metrics->counter("worker_tasks_total", QString("worker=\"%1\"").arg(index));
+    m_yieldCounter = metrics->counter("worker_yields_total", QString("worker=\"%1\"").arg(index));
+    m_connectionGauge = metrics->gauge("hub_connections");
+    m_clientGauge = metrics->gauge("worker_clients", QString("worker=\"%1\"").arg(index));
+
+    m_thread->setObjectName(QString("worker-%1").arg(index));
+
+    moveToThread(m_thread);
+    connect(m_thread, &QThread::started, this, &Worker::init);
+    m_thread->start();
+}
+
+Worker::~Worker(void)
+{
+    QMetaObject::invokeMethod(this, [this] ()
+    {
+        QList <qint64> list = m_objects.keys();
+
+        for (int i = 0; i < list.count(); i++)
+            detach(list.at(i));
+
+        delete m_timer;
+
+    }, Qt::BlockingQueuedConnection);
+
+    m_thread->quit();
+    m_thread->wait();
+
+    delete m_thread;
+}
+
+void Worker::post(const Task &task, Priority priority)
+{
+    if (priority == Priority::Bulk)
+        m_bulk.push(task);
+    else
+        m_queue.push(task);
+
+    if (m_signalled.fetchAndStoreOrdered(1))
+        return;
+
+    QMetaObject::invokeMethod(this, "process", Qt::QueuedConnection);
+}
+
+void Worker::attach(qint64 chat, const QByteArray &name, Client *client)
+{
+    UserObject *object = m_objects.value(chat);
+    Client *other;
+
+    connect(client, &Client::disconnected, this, &Worker::disconnected);
+    connect(client, &Client::devicesUpdated, this, &Worker::devicesUpdated);
+    connect(client, &Client::dataUpdated, this, &Worker::dataUpdated);
+
+    if (!client->connected())
+    {
+        m_connectionGauge->add(-1);
+        client->deleteLater();
+        return;
+    }
+
+    if (!object)
+    {
+        object = new UserObject(chat, name);
+        m_objects.insert(chat, object);
+        emit userAttached(chat);
+    }
+
+    other = object->clients().value(client->uniqueId());
+
+    qDebug() << "Client" << QString("%1:%2").arg(name, client->uniqueId()) << (other ? "replaced" : "authorized") << "on worker" << m_index;
+    client->setParent(object);
+    object->clients().insert(client->uniqueId(), client);
+    client->resume();
+
+    if (!other)
+        return;
+
+    other->close();
+    other->deleteLater();
+}
+
+void Worker::detach(qint64 chat)
+{
+    UserObject *object = m_objects.take(chat);
+    QList <Client*> list;
+
+    if (!object)
+        return;
+
+    list = object->clients().values();
+    object->clients().clear();
+
+    for (int i = 0; i < list.count(); i++)
+    {
+        list.at(i)->setParent(nullptr);
+        list.at(i)->close();
+    }
+
+    delete object;
+    emit userDetached(chat);
+}
+
+QList <Handoff> Worker::handoff(void)
+{
+    QList <Handoff> list;
+    QList <qint64> chats = m_objects.keys();
+
+    for (auto it = m_objects.begin(); it != m_objects.end(); it++)
+    {
+        for (auto item = it.value()->clients().begin(); item != it.value()->clients().end(); item++)
+        {
+            Client *client = item.value();
+            QJsonObject state;
+            int descriptor;
+
+            if (!client->connected() || client->secure() || (descriptor = dup(client->descriptor())) < 0)
+                continue;
+
+            state = client->handoff();
+            state.insert("chat", QString::number(it.key()));
+            list.append({descriptor, state});
+        }
+    }
+
+    for (int i = 0; i < chats.count(); i++)
+        detach(chats.at(i));
+
+    return list;
+}
+
+UserObject *Worker::object(qint64 chat)
+{
+    return m_objects.value(chat);
+}
+
+QMap <QString, Client*> Worker::clients(qint64 chat)
+{
+    UserObject *object = m_objects.value(chat);
+    return object ? object->clients() : QMap <QString, Client*> ();
+}
+
+void Worker::init(void)
+{
+    m_timer = new QTimer;
+    connect(m_timer, &QTimer::timeout, this, &Worker::updateStats);
+    m_timer->start(WORKER_STATS_INTERVAL);
+}
+
+void Worker::process(void)
+{
+    QElapsedTimer timer;
+    Task task;
+
+    m_signalled.fetchAndStoreOrdered(0);
+    timer.start();
+
+    while (true)
+    {
+        while (m_queue.pop(task))
+        {
+            task(this);
+            m_taskCounter->increment();
+        }
+
+        if (!m_bulk.pop(task))
+            break;
+
+        task(this);
+        m_taskCounter->increment();
+
+        if (timer.nsecsElapsed() < WORKER_TIME_SLICE)
+            continue;
+
+        m_yieldCounter->increment();
+
+        if (m_signalled.fetchAndStoreOrdered(1))
+            return;
+
+        QMetaObject::invokeMethod(this, "process", Qt::QueuedConnection);
+        return;
+    }
+}
+
+void Worker::updateStats(void)
+{
+    qint64 clients = 0, queue = 0;
+
+    for (auto it = m_objects.begin(); it != m_objects.end(); it++)
+    {
+        for (auto item = it.value()->clients().begin(); item != it.value()->clients().end(); item++)
+            queue += item.value()->bytesToWrite();
+
+        clients += it.value()->clients().count();
+    }
+
+    m_clientCount.storeRelaxed(clients);
+    m_queueBytes.storeRelaxed(queue);
+    m_clientGauge->set(clients);
+
+    if (m_deferred.isEmpty() || Watchdog::level() != Watchdog::Level::Normal)
+        return;
+
+    for (auto it = m_deferred.begin(); it != m_deferred.end(); it++)
+    {
+        UserObject *object = m_objects.value(*it);
+
+        if (!object)
+            continue;
+
+        sendDiscovery(object);
+    }
+
+    m_deferred.clear();
+}
+
+void Worker::sendDiscovery(UserObject *object)
+{
+    QJsonObject json = {{"ts", QDateTime::currentSecsSinceEpoch()}, {"payload", QJsonObject {{"user_id", object->name().constData()}}}};
+    system(QString("curl --http1.1 -m 5 -X POST -H 'Authorization: OAuth %1' -H 'Content-Type: application/json' -d '%2' -s https://dialogs.yandex.net/api/v1/skills/%3/callback/discovery > /dev/null &").arg(m_skillToken, QJsonDocument(json).toJson(QJsonDocument::Compact).constData(), m_skillId).toUtf8().constData());
+    m_discoveryCounter->increment();
+}
+
+void Worker::disconnected(void)
+{
+    Client *client = reinterpret_cast <Client*> (sender());
+    UserObject *object = reinterpret_cast <UserObject*> (client->parent());
+
+    if (object)
+    {
+        bool check = false;
+
+        if (object->clients().value(client->uniqueId()) == client)
+        {
+            object->clients().remove(client->uniqueId());
+            check = true;
+        }
+
+        qDebug() << "Client" << QString("%1:%2").arg(object->name(), client->uniqueId()) << (check ? "disconnected:" : "stale connection closed:") << client->socketError();
+
+        if (object->clients().isEmpty())
+        {
+            m_objects.remove(object->chat());
+            object->deleteLater();
+            emit userDetached(object->chat());
+        }
+    }
+
+    m_connectionGauge->add(-1);
+    client->deleteLater();
+}
+
+void Worker::devicesUpdated(void)
+{
+    Client *client = reinterpret_cast <Client*> (sender());
+    UserObject *object = reinterpret_cast <UserObject*> (client->parent());
+
+    if (!object)
+        return;
+
+    if (Watchdog::level() != Watchdog::Level::Normal)
+    {
+        m_deferred.insert(object->chat());
+        m_deferredCounter->increment();
+        return;
+    }
+
+    sendDiscovery(object);
+}
+
+void Worker::dataUpdated(const Device &device)
+{
+    Client *client = reinterpret_cast <Client*> (sender());
+    UserObject *object = reinterpret_cast <UserObject*> (client->parent());
+    QJsonObject json = {{"ts", QDateTime::currentSecsSinceEpoch()}};
+    QJsonArray devices;
+
+    if (!object)
+        return;
+
+    for (auto it = device->endpoints().begin(); it != device->endpoints().end(); it++)
+    {
+        const Endpoint &endpoint = it.value();
+        QString id = client->uniqueId().append('/').append(device->key());
+        QJsonArray capabilities, properties;
+
+        if (endpoint->id())
+            id.append(QString("/%1").arg(endpoint->id()));
+
+        for (int i = 0; i < endpoint->capabilities().count(); i++)
+        {
+            const Capability &capability = endpoint->capabilities().at(i);
+
+            if (!capability->updated())
+                continue;
+
+            capabilities.append(QJsonObject {{"type", capability->type()}, {"state", capability->state()}});
+            capability->setUpdated(false);
+        }
+
+        for (auto it = endpoint->properties().begin(); it != endpoint->properties().end(); it++)
+        {
+            if (!it.value()->updated())
+                continue;
+
+            properties.append(QJsonObject {{"type", it.value()->type()}, {"state", it.value()->state()}});
+            it.value()->setUpdated(false);
+
+            if (it.value()->instance() != "button" && it.value()->instance() != "vibration")
+                continue;
+
+            it.value()->setValue(QVariant());
+        }
+
+        if (capabilities.isEmpty() && properties.isEmpty())
+            continue;
+
+        devices.append(QJsonObject {{"id", id}, {"capabilities", capabilities}, {"properties", properties}});
+    }
+
+    if (!devices.isEmpty())
+    {
+        json.insert("payload", QJsonObject {{"user_id", object->name().constData()}, {"devices", devices}});
+        system(QString("curl --http1.1 -m 5 -X POST -H 'Authorization: OAuth %1' -H 'Content-Type: application/json' -d '%2' -s https://dialogs.yandex.net/api/v1/skills/%3/callback/state > /dev/null &").arg(m_skillToken, QJsonDocument(json).toJson(QJsonDocument::Compact).constData(), m_skillId).toUtf8().constData());
+        m_stateCounter->increment();
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#define WORKER_STATS_INTERVAL   1000
+#define WORKER_TIME_SLICE       5000000
+
+#include <functional>
+#include <QSet>
+#include <QThread>
+#include "upgrade.h"
+#include "user.h"
+#include "watchdog.h"
+
+class Worker;
+typedef std::function <void (Worker*)> Task;
+
+enum class Priority
+{
+    Interactive,
+    Bulk
+};
+
+class TaskQueue
+{
+
+public:
+
+    TaskQueue(void);
+    ~TaskQueue(void);
+
+    void push(const Task &task);
+    bool pop(Task &task);
+
+private:
+
+    struct Node
+    {
+        QAtomicPointer <Node> next;
+        Task task;
+    };
+
+    QAtomicPointer <Node> m_head;
+    Node *m_tail;
+
+};
+
+class Worker : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    Worker(int index, const QByteArray &skillId, const QByteArray &skillToken, bool debug);
+    ~Worker(void);
+
+    inline int index(void) { return m_index; }
+    inline qint64 clientCount(void) { return m_clientCount.loadRelaxed(); }
+    inline qint64 queueBytes(void) { return m_queueBytes.loadRelaxed(); }
+
+    void post(const Task &task, Priority priority = Priority::Interactive);
+
+    void attach(qint64 chat, const QByteArray &name, Client *client);
+    void detach(qint64 chat);
+
+    QList <Handoff> handoff(void);
+
+    UserObject *object(qint64 chat);
+    QMap <QString, Client*> clients(qint64 chat);
+
+private:
+
+    QThread *m_thread;
+    QTimer *m_timer;
+
+    TaskQueue m_queue, m_bulk;
+    QAtomicInt m_signalled;
+
+    int m_index;
+    QByteArray m_skillId, m_skillToken;
+    bool m_debug;
+
+    QHash <qint64, UserObject*> m_objects;
+    QSet <qint64> m_deferred;
+    QAtomicInteger <qint64> m_clientCount, m_queueBytes;
+
+    Counter *m_discoveryCounter, *m_deferredCounter, *m_stateCounter, *m_taskCounter, *m_yieldCounter;
+    Gauge *m_connectionGauge, *m_clientGauge;
+
+    void sendDiscovery(UserObject *object);
+
+private slots:
+
+    void init(void);
+    void process(void);
+    void updateStats(void);
+
+    void disconnected(void);
+    void devicesUpdated(void);
+    void dataUpdated(const Device &device);
+
+signals:
+
+    void userAttached(qint64 chat);
+    void userDetached(qint64 chat);
+
+};
+
+#endif
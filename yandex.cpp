@@ -0,0 +1,183 @@
+#include "yandex.h"
+
+QJsonArray Yandex::devices(const QMap <QString, Client*> &clients)
+{
+    QJsonArray devices;
+
+    for (auto it = clients.begin(); it != clients.end(); it++)
+    {
+        Client *client = it.value();
+
+        for (auto it = client->devices().begin(); it != client->devices().end(); it++)
+            device(client, it.value(), devices);
+    }
+
+    return devices;
+}
+
+void Yandex::device(Client *client, const Device &device, QJsonArray &devices)
+{
+    for (auto it = device->endpoints().begin(); it != device->endpoints().end(); it++)
+    {
+        const Endpoint &endpoint = it.value();
+        QJsonArray capabilities, properties;
+
+        for (int i = 0; i < endpoint->capabilities().count(); i++)
+        {
+            const Capability &capability = endpoint->capabilities().at(i);
+            QJsonObject item = {{"type", capability->type()}, {"retrievable", true}, {"reportable", true}, {"state", capability->state()}};
+
+            if (!capability->parameters().isEmpty())
+                item.insert("parameters", QJsonObject::fromVariantMap(capability->parameters()));
+
+            capabilities.append(item);
+        }
+
+        for (auto it = endpoint->properties().begin(); it != endpoint->properties().end(); it++)
+        {
+            QJsonObject item = {{"type", it.value()->type()}, {"retrievable", true}, {"reportable", true}, {"parameters", QJsonObject::fromVariantMap(it.value()->parameters())}};
+
+            if (it.value()->value().isValid())
+                item.insert("state", it.value()->state());
+
+            properties.append(item);
+        }
+
+        if (!capabilities.isEmpty() || !properties.isEmpty())
+        {
+            QString id = client->uniqueId().append('/').append(device->key()), name = device->name(), model = device->name();
+
+            if (it.value()->id())
+            {
+                QString endpointName = endpoint->options().value("name").toString();
+                id.append(QString("/%1").arg(it.value()->id()));
+                name.append(QString(" %1").arg(!endpointName.isEmpty() ? endpointName : QString::number(it.value()->id())));
+            }
+
+            if (!device->description().isEmpty())
+                model.append(QString(" (%1)").arg(device->description()));
+
+            devices.append(QJsonObject {{"id", id}, {"name", name}, {"type", endpoint->type()}, {"capabilities", capabilities}, {"properties", properties}, {"device_info", QJsonObject{{"model", model}}}});
+        }
+    }
+}
+
+QJsonArray Yandex::query(const QMap <QString, Client*> &clients, const QJsonArray &queries)
+{
+    QJsonArray devices;
+
+    for (auto it = queries.begin(); it != queries.end(); it++)
+    {
+        QJsonObject query = it->toObject();
+        QString id = query.value("id").toString();
+        QList <QString> list = id.split('/');
+        Client *client = clients.value(list.value(0));
+
+        if (client)
+        {
+            const Device &device = client->devices().value(QString("%1/%2").arg(list.value(1), list.value(2)));
+
+            if (device.isNull())
+            {
+                devices.append(QJsonObject {{"id", id}, {"error_code", "DEVICE_NOT_FOUND"}});
+                continue;
+            }
+
+            if (device->available())
+            {
+                const Endpoint &endpoint = device->endpoints().value(static_cast <quint8> (list.value(3).toInt()));
+                QJsonArray capabilities, properties;
+
+                if (endpoint.isNull())
+                {
+                    devices.append(QJsonObject {{"id", id}, {"error_code", "DEVICE_NOT_FOUND"}});
+                    continue;
+                }
+
+                for (int i = 0; i < endpoint->capabilities().count(); i++)
+                {
+                    const Capability &capability = endpoint->capabilities().at(i);
+                    capabilities.append(QJsonObject {{"type", capability->type()}, {"state", capability->state()}});
+                }
+
+                for (auto it = endpoint->properties().begin(); it != endpoint->properties().end(); it++)
+                {
+                    if (!it.value()->value().isValid())
+                        continue;
+
+                    properties.append(QJsonObject {{"type", it.value()->type()}, {"state", it.value()->state()}});
+                }
+
+                devices.append(QJsonObject {{"id", id}, {"capabilities", capabilities}, {"properties", properties}});
+                continue;
+            }
+        }
+
+        devices.append(QJsonObject {{"id", id}, {"error_code", "DEVICE_UNREACHABLE"}});
+    }
+
+    return devices;
+}
+
+QJsonArray Yandex::action(const QMap <QString, Client*> &clients, const QJsonArray &actions, const QString &requestId, const QElapsedTimer &timer)
+{
+    QJsonArray devices;
+
+    for (auto it = actions.begin(); it != actions.end(); it++)
+    {
+        QJsonObject action = it->toObject();
+        QJsonArray capabilities = action.value("capabilities").toArray();
+        QString id = action.value("id").toString();
+        QList <QString> list = id.split('/');
+        Client *client = clients.value(list.value(0));
+        bool check = false;
+
+        if (client)
+        {
+            const Device &device = client->devices().value(QString("%1/%2").arg(list.value(1), list.value(2)));
+
+            if (device.isNull())
+            {
+                devices.append(QJsonObject {{"id", action.value("id")}, {"action_result", QJsonObject {{"status", "ERROR"}, {"error_code", "DEVICE_NOT_FOUND"}}}});
+                continue;
+            }
+
+            if (device->available())
+            {
+                const Endpoint &endpoint = device->endpoints().value(static_cast <quint8> (list.value(3).toInt()));
+
+                if (!endpoint.isNull())
+                {
+                    for (auto it = capabilities.begin(); it != capabilities.end(); it++)
+                    {
+                        QJsonObject json = it->toObject(), state = json.value("state").toObject();
+                        QString type = json.value("type").toString(), instance = state.value("instance").toString();
+
+                        for (int i = 0; i < endpoint->capabilities().count(); i++)
+                        {
+                            const Capability &capability = endpoint->capabilities().at(i);
+
+                            if (capability->type() == type && capability->instances().contains(instance))
+                            {
+                                client->publish(endpoint, capability->action(state));
+                                client->trace(endpoint, capability, requestId, timer);
+                                check = true;
+                                break;
+                            }
+                        }
+                    }
+                }
+
+                if (check)
+                {
+                    devices.append(QJsonObject {{"id", action.value("id")}, {"action_result", QJsonObject {{"status", "DONE"}}}});
+                    continue;
+                }
+            }
+        }
+
+        devices.append(QJsonObject {{"id", action.value("id")}, {"action_result", QJsonObject {{"status", "ERROR"}, {"error_code", "DEVICE_UNREACHABLE"}}}});
+    }
+
+    return devices;
+}
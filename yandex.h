@@ -0,0 +1,14 @@
+#ifndef YANDEX_H
+#define YANDEX_H
+
+#include "client.h"
+
+namespace Yandex
+{
+    QJsonArray devices(const QMap <QString, Client*> &clients);
+    void device(Client *client, const Device &device, QJsonArray &devices);
+    QJsonArray query(const QMap <QString, Client*> &clients, const QJsonArray &queries);
+    QJsonArray action(const QMap <QString, Client*> &clients, const QJsonArray &actions, const QString &requestId, const QElapsedTimer &timer);
+}
+
+#endif